@@ -0,0 +1,654 @@
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "sys/elf_common.h"
+
+#include "archive.hpp"
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+static constexpr size_t TAR_BLOCK = 512;
+static constexpr uint64_t TAR_MAX_NAME = 1 << 20; /* GNU or pax long name */
+
+/*
+ * the tar stream of an archive, read forward. While an archive is
+ * scanned, the last ARCHIVE_WINDOW bytes inflated are kept in a ring so
+ * that access points can be taken at the ends of deflate blocks.
+ */
+class ArchiveStream {
+    private:
+	int fd;
+	bool gzip;
+	bool ended = false;
+	z_stream zs {};
+	std::vector<unsigned char> in, out;
+	size_t out_pos = 0, out_len = 0;
+	uint64_t pos = 0; /* offset in the tar stream of out[out_pos] */
+	AcctVector<ArchivePoint, M_INFLATE> *points;
+	std::vector<unsigned char> ring;
+	size_t ring_pos = 0;
+	uint64_t last_point = 0;
+	std::string error;
+
+	bool fail(const std::string &why);
+	bool fill();
+	void keep(const unsigned char *data, size_t len);
+
+    public:
+	ArchiveStream(int fd, bool gzip,
+	    AcctVector<ArchivePoint, M_INFLATE> *points = nullptr);
+	~ArchiveStream();
+
+	bool resume(const ArchivePoint &point);
+	bool read(void *buf, size_t len);
+	bool skip(uint64_t len);
+	uint64_t tell() const { return (pos); }
+	const std::string &why() const { return (error); }
+};
+
+ArchiveStream::ArchiveStream(int fd, bool gzip,
+    AcctVector<ArchivePoint, M_INFLATE> *points)
+    : fd(fd)
+    , gzip(gzip)
+    , in(gzip ? 1 << 16 : 0)
+    , out(1 << 16)
+    , points(points)
+    , ring(points != nullptr ? ARCHIVE_WINDOW : 0)
+{
+	/* 32 added to the window bits detects the gzip header */
+	if (gzip && inflateInit2(&zs, 15 + 32) != Z_OK)
+		fail("cannot initialize zlib");
+}
+
+ArchiveStream::~ArchiveStream()
+{
+	if (gzip)
+		inflateEnd(&zs);
+}
+
+bool
+ArchiveStream::fail(const std::string &why)
+{
+	if (error.empty())
+		error = why;
+	return (false);
+}
+
+/* the ring holding the last ARCHIVE_WINDOW bytes inflated */
+void
+ArchiveStream::keep(const unsigned char *data, size_t len)
+{
+	if (len >= ring.size()) {
+		memcpy(ring.data(), data + len - ring.size(), ring.size());
+		ring_pos = 0;
+		return;
+	}
+
+	size_t first = std::min(len, ring.size() - ring_pos);
+
+	memcpy(ring.data() + ring_pos, data, first);
+	memcpy(ring.data(), data + first, len - first);
+	ring_pos = (ring_pos + len) % ring.size();
+}
+
+/* at least one more byte of the tar stream in out */
+bool
+ArchiveStream::fill()
+{
+	out_pos = out_len = 0;
+
+	if (!error.empty())
+		return (false);
+
+	if (!gzip) {
+		ssize_t n = ::read(fd, out.data(), out.size());
+
+		if (n == -1)
+			return (fail(strerror(errno)));
+		if (n == 0)
+			return (fail("the archive is truncated"));
+		out_len = n;
+		return (true);
+	}
+
+	zs.next_out = out.data();
+	zs.avail_out = out.size();
+
+	while (zs.avail_out == out.size()) {
+		if (ended)
+			return (fail("the archive is truncated"));
+
+		if (zs.avail_in == 0) {
+			ssize_t n = ::read(fd, in.data(), in.size());
+
+			if (n == -1)
+				return (fail(strerror(errno)));
+			if (n == 0)
+				return (fail("the archive is truncated"));
+			zs.next_in = in.data();
+			zs.avail_in = n;
+		}
+
+		unsigned char *start = zs.next_out;
+		int ret = inflate(&zs, Z_BLOCK);
+
+		if (ret == Z_STREAM_END)
+			ended = true;
+		else if (ret != Z_OK)
+			return (fail(zs.msg != nullptr ? zs.msg : "inflate failed"));
+
+		if (points == nullptr)
+			continue;
+
+		keep(start, zs.next_out - start);
+
+		/* between two blocks, not after the last one */
+		if ((zs.data_type & 128) && !(zs.data_type & 64) &&
+		    zs.total_out - last_point >= ARCHIVE_SPAN) {
+			ArchivePoint &point = points->emplace_back();
+
+			point.out = zs.total_out;
+			point.in = zs.total_in;
+			point.bits = zs.data_type & 7;
+			std::copy(ring.begin() + ring_pos, ring.end(),
+			    point.window.begin());
+			std::copy(ring.begin(), ring.begin() + ring_pos,
+			    point.window.begin() + (ring.size() - ring_pos));
+			last_point = zs.total_out;
+		}
+	}
+
+	out_len = out.size() - zs.avail_out;
+	return (true);
+}
+
+/* continue a raw inflate from a point taken while scanning */
+bool
+ArchiveStream::resume(const ArchivePoint &point)
+{
+	off_t at = point.in - (point.bits != 0 ? 1 : 0);
+
+	inflateEnd(&zs);
+	zs = {};
+	if (inflateInit2(&zs, -15) != Z_OK)
+		return (fail("cannot initialize zlib"));
+
+	if (lseek(fd, at, SEEK_SET) == -1)
+		return (fail(strerror(errno)));
+
+	if (point.bits != 0) {
+		unsigned char c;
+
+		if (::read(fd, &c, 1) != 1)
+			return (fail("the archive is truncated"));
+		inflatePrime(&zs, point.bits, c >> (8 - point.bits));
+	}
+	inflateSetDictionary(&zs, point.window.data(), point.window.size());
+
+	out_pos = out_len = 0;
+	pos = point.out;
+	ended = false;
+	return (true);
+}
+
+bool
+ArchiveStream::read(void *buf, size_t len)
+{
+	unsigned char *p = static_cast<unsigned char *>(buf);
+
+	while (len > 0) {
+		if (out_pos == out_len && !fill())
+			return (false);
+
+		size_t n = std::min(len, out_len - out_pos);
+
+		memcpy(p, out.data() + out_pos, n);
+		out_pos += n;
+		pos += n;
+		p += n;
+		len -= n;
+	}
+
+	return (true);
+}
+
+bool
+ArchiveStream::skip(uint64_t len)
+{
+	/* a plain tar is seeked past what is not buffered */
+	if (!gzip && len > out_len - out_pos) {
+		uint64_t ahead = len - (out_len - out_pos);
+
+		if (lseek(fd, ahead, SEEK_CUR) == -1)
+			return (fail(strerror(errno)));
+		out_pos = out_len = 0;
+		pos += len;
+		return (true);
+	}
+
+	while (len > 0) {
+		if (out_pos == out_len && !fill())
+			return (false);
+
+		size_t n = std::min<uint64_t>(len, out_len - out_pos);
+
+		out_pos += n;
+		pos += n;
+		len -= n;
+	}
+
+	return (true);
+}
+
+/* an octal field of a header, or base-256 as GNU tar writes large sizes */
+static bool
+tar_number(const unsigned char *field, size_t len, uint64_t &value)
+{
+	value = 0;
+
+	if (field[0] & 0x80) {
+		if ((field[0] & 0x7f) != 0)
+			return (false);
+		for (size_t i = 1; i < len; ++i) {
+			if (value >> 56)
+				return (false);
+			value = value << 8 | field[i];
+		}
+		return (true);
+	}
+
+	size_t i = 0;
+
+	while (i < len && field[i] == ' ')
+		++i;
+	for (; i < len && field[i] >= '0' && field[i] <= '7'; ++i) {
+		if (value >> 60)
+			return (false);
+		value = value << 3 | (field[i] - '0');
+	}
+
+	return (i == len || field[i] == ' ' || field[i] == '\0');
+}
+
+/* the checksum counts itself as spaces, old tars summed signed chars */
+static bool
+tar_header_valid(const unsigned char *block)
+{
+	uint64_t sum = 0, expected;
+	int64_t ssum = 0;
+
+	if (!tar_number(block + 148, 8, expected))
+		return (false);
+
+	for (size_t i = 0; i < TAR_BLOCK; ++i) {
+		unsigned char c = i >= 148 && i < 156 ? ' ' : block[i];
+
+		sum += c;
+		ssum += static_cast<signed char>(c);
+	}
+
+	return (sum == expected || (uint64_t)ssum == expected);
+}
+
+static std::string
+tar_string(const unsigned char *field, size_t len)
+{
+	const char *s = reinterpret_cast<const char *>(field);
+
+	return (std::string(s, strnlen(s, len)));
+}
+
+/* the path= record of a pax extended header */
+static std::string
+pax_path(const std::string &records)
+{
+	size_t off = 0;
+
+	while (off < records.size()) {
+		size_t space = records.find(' ', off);
+		unsigned long len;
+
+		if (space == std::string::npos)
+			break;
+		len = strtoul(records.c_str() + off, nullptr, 10);
+		if (len <= space - off || off + len > records.size())
+			break;
+
+		std::string_view record(records.data() + space + 1,
+		    len - (space + 1 - off) - 1);
+
+		if (record.substr(0, 5) == "path=")
+			return (std::string(record.substr(5)));
+		off += len;
+	}
+
+	return ("");
+}
+
+/* member names are matched without a leading ./ or / */
+static std::string_view
+member_name(std::string_view name)
+{
+	for (;;) {
+		if (name.substr(0, 2) == "./")
+			name.remove_prefix(2);
+		else if (name.substr(0, 1) == "/")
+			name.remove_prefix(1);
+		else
+			return (name);
+	}
+}
+
+/*
+ * one pass over the archive, listing its regular files and taking the
+ * access points of a gzip archive on the way
+ */
+bool
+Archive::scan()
+{
+	unsigned char block[TAR_BLOCK], magic[6] = {};
+	std::string long_name, pax_name;
+	struct stat st;
+	int fd;
+
+	if ((fd = ::open(path.c_str(), O_RDONLY)) == -1 ||
+	    fstat(fd, &st) == -1) {
+		std::cout << "Cannot open archive " << path << ": "
+			  << strerror(errno) << '\n';
+		if (fd != -1)
+			close(fd);
+		return (false);
+	}
+
+	this->mtime = st.st_mtim;
+	this->file_size = st.st_size;
+
+	if (pread(fd, magic, sizeof(magic), 0) == -1) {
+		std::cout << "Cannot read archive " << path << '\n';
+		close(fd);
+		return (false);
+	}
+	if (memcmp(magic, "\xfd" "7zXZ", 6) == 0) {
+		std::cout << "Cannot read archive " << path
+			  << ": only gzip compression is supported, not xz\n";
+		close(fd);
+		return (false);
+	}
+	this->gzip = magic[0] == 0x1f && magic[1] == 0x8b;
+
+	ArchiveStream stream(fd, gzip, gzip ? &points : nullptr);
+	bool ok = true;
+
+	for (;;) {
+		uint64_t at = stream.tell(), size;
+
+		if (!stream.read(block, sizeof(block))) {
+			ok = false;
+			break;
+		}
+
+		/* the end of the archive is marked by zero blocks */
+		if (std::all_of(block, block + sizeof(block),
+			[](unsigned char c) { return (c == 0); }))
+			break;
+
+		if (!tar_header_valid(block) ||
+		    !tar_number(block + 124, 12, size)) {
+			if (at == 0)
+				std::cout << path << " is not a tar archive\n";
+			else
+				std::cout << "Cannot read archive " << path
+					  << ": the header at offset " << at
+					  << " is corrupt\n";
+			close(fd);
+			return (false);
+		}
+
+		uint64_t padded = (size + TAR_BLOCK - 1) & ~(TAR_BLOCK - 1);
+		char type = block[156];
+
+		if (type == 'L' || type == 'x') {
+			std::string data(std::min(size, TAR_MAX_NAME), '\0');
+
+			if (!stream.read(data.data(), data.size()) ||
+			    !stream.skip(padded - data.size())) {
+				ok = false;
+				break;
+			}
+			if (type == 'L')
+				long_name = data.c_str();
+			else
+				pax_name = pax_path(data);
+			continue;
+		}
+
+		if (type != '0' && type != '\0' && type != '7') {
+			long_name.clear();
+			pax_name.clear();
+			if (!stream.skip(padded)) {
+				ok = false;
+				break;
+			}
+			continue;
+		}
+
+		std::string name;
+
+		if (!pax_name.empty())
+			name = pax_name;
+		else if (!long_name.empty())
+			name = long_name;
+		else if (memcmp(block + 257, "ustar", 5) == 0 &&
+		    block[345] != '\0')
+			name = tar_string(block + 345, 155) + "/" +
+			    tar_string(block, 100);
+		else
+			name = tar_string(block, 100);
+		long_name.clear();
+		pax_name.clear();
+
+		ArchiveMember member { std::string(member_name(name)),
+			stream.tell(), size, false };
+		char elf[SELFMAG];
+		uint64_t peek = size >= SELFMAG ? SELFMAG : 0;
+
+		if (peek != 0 && !stream.read(elf, peek)) {
+			ok = false;
+			break;
+		}
+		member.elf = peek != 0 && memcmp(elf, ELFMAG, SELFMAG) == 0;
+		if (!stream.skip(padded - peek)) {
+			ok = false;
+			break;
+		}
+
+		members.push_back(std::move(member));
+	}
+
+	if (!ok)
+		std::cout << "Cannot read archive " << path << ": "
+			  << stream.why() << '\n';
+	close(fd);
+
+	if (!ok)
+		return (false);
+
+	/* a member appended again replaces the earlier copy, as on extraction */
+	std::stable_sort(members.begin(), members.end(),
+	    [](const ArchiveMember &a, const ArchiveMember &b) {
+		    return (a.name < b.name);
+	    });
+
+	std::vector<ArchiveMember> unique;
+
+	for (auto &m : members) {
+		if (!unique.empty() && unique.back().name == m.name)
+			unique.back() = std::move(m);
+		else
+			unique.push_back(std::move(m));
+	}
+	members = std::move(unique);
+
+	return (true);
+}
+
+const ArchiveMember *
+Archive::find(std::string_view name) const
+{
+	name = member_name(name);
+
+	auto it = std::lower_bound(members.begin(), members.end(), name,
+	    [](const ArchiveMember &m, std::string_view n) {
+		    return (m.name < n);
+	    });
+
+	return (it != members.end() && it->name == name ? &*it : nullptr);
+}
+
+/*
+ * the contents of one member. A plain tar is read in place, a gzip one is
+ * inflated from the last access point before the member.
+ */
+bool
+Archive::read(const ArchiveMember &member,
+    AcctVector<std::byte, M_INFLATE> &out) const
+{
+	int fd;
+
+	if ((fd = ::open(path.c_str(), O_RDONLY)) == -1) {
+		std::cout << "Cannot open archive " << path << ": "
+			  << strerror(errno) << '\n';
+		return (false);
+	}
+
+	out.resize(member.size);
+
+	std::string error;
+
+	if (!gzip) {
+		for (size_t done = 0; done < out.size();) {
+			ssize_t n = pread(fd, out.data() + done,
+			    out.size() - done, member.offset + done);
+
+			if (n <= 0) {
+				error = n == 0 ? "the archive is truncated" :
+						 strerror(errno);
+				break;
+			}
+			done += n;
+		}
+	} else {
+		ArchiveStream stream(fd, true);
+		auto point = std::upper_bound(points.begin(), points.end(),
+		    member.offset, [](uint64_t offset, const ArchivePoint &p) {
+			    return (offset < p.out);
+		    });
+
+		if ((point != points.begin() && !stream.resume(*--point)) ||
+		    !stream.skip(member.offset - stream.tell()) ||
+		    !stream.read(out.data(), out.size()))
+			error = stream.why();
+	}
+
+	close(fd);
+
+	if (!error.empty()) {
+		std::cout << "Cannot read " << member.name << " from archive "
+			  << path << ": " << error << '\n';
+		out.clear();
+		return (false);
+	}
+
+	return (true);
+}
+
+/*
+ * archives by path. Each is scanned again only when it changed, so a tree
+ * or a batch of its members costs one pass over the archive.
+ */
+static std::mutex archive_lock;
+static std::unordered_map<std::string, std::shared_ptr<const Archive>> archives;
+
+std::shared_ptr<const Archive>
+Archive::open(const std::string &path)
+{
+	struct stat st;
+
+	if (stat(path.c_str(), &st) == -1) {
+		std::cout << "Cannot open archive " << path << ": "
+			  << strerror(errno) << '\n';
+		return (nullptr);
+	}
+
+	std::lock_guard<std::mutex> guard(archive_lock);
+	auto &entry = archives[path];
+
+	if (entry != nullptr && entry->file_size == st.st_size &&
+	    entry->mtime.tv_sec == st.st_mtim.tv_sec &&
+	    entry->mtime.tv_nsec == st.st_mtim.tv_nsec)
+		return (entry);
+
+	auto archive = std::make_shared<Archive>();
+
+	archive->path = path;
+	if (!archive->scan()) {
+		archives.erase(path);
+		return (nullptr);
+	}
+
+	return (entry = std::move(archive));
+}
+
+bool
+is_archive(const std::string &path)
+{
+	unsigned char block[TAR_BLOCK];
+	struct stat st;
+	int fd;
+
+	if (stat(path.c_str(), &st) == -1 || !S_ISREG(st.st_mode) ||
+	    (fd = ::open(path.c_str(), O_RDONLY)) == -1)
+		return (false);
+
+	ssize_t n = ::read(fd, block, sizeof(block));
+
+	close(fd);
+
+	if (n >= 2 && block[0] == 0x1f && block[1] == 0x8b)
+		return (true);
+	if (n >= 6 && memcmp(block, "\xfd" "7zXZ", 6) == 0)
+		return (true); /* refused with a message once scanned */
+
+	return (n == (ssize_t)sizeof(block) && tar_header_valid(block));
+}
+
+bool
+split_archive_path(const std::string &path, std::string &archive,
+    std::string &member)
+{
+	struct stat st;
+
+	if (stat(path.c_str(), &st) == 0)
+		return (false);
+
+	for (size_t colon = path.find(':'); colon != std::string::npos;
+	     colon = path.find(':', colon + 1)) {
+		std::string prefix = path.substr(0, colon);
+
+		if (is_archive(prefix)) {
+			archive = std::move(prefix);
+			member = path.substr(colon + 1);
+			return (true);
+		}
+	}
+
+	return (false);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include "memacct.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * tar archives, plain or gzip compressed, as build artifacts are stored.
+ * An archive is scanned once for its members. For gzip the scan also
+ * keeps the state of zlib every ARCHIVE_SPAN bytes of the tar stream, so
+ * a member is inflated from the nearest such point rather than from the
+ * start of the archive.
+ */
+
+static constexpr size_t ARCHIVE_SPAN = 1 << 20;
+static constexpr size_t ARCHIVE_WINDOW = 1 << 15; /* the deflate window */
+
+/* where inflate can resume, as in zran.c of zlib */
+struct ArchivePoint {
+	uint64_t out;  /* offset in the tar stream */
+	uint64_t in;   /* offset in the file of the first full byte */
+	int bits;      /* bits of the byte before in still to inflate */
+	std::array<unsigned char, ARCHIVE_WINDOW> window;
+};
+
+struct ArchiveMember {
+	std::string name;  /* normalized, without a leading ./ */
+	uint64_t offset;   /* of the contents in the tar stream */
+	uint64_t size;
+	bool elf;	   /* the contents start with the ELF magic */
+};
+
+struct Archive {
+    private:
+	std::string path;
+	bool gzip = false;
+	struct timespec mtime {};
+	off_t file_size = 0;
+	AcctVector<ArchivePoint, M_INFLATE> points;
+	std::vector<ArchiveMember> members; /* sorted by name */
+
+	bool scan();
+
+    public:
+	/* an archive scanned once and shared, nullptr when it can't be read */
+	static std::shared_ptr<const Archive> open(const std::string &path);
+
+	const std::string &file_name() const { return (path); }
+	const std::vector<ArchiveMember> &contents() const { return (members); }
+	const ArchiveMember *find(std::string_view name) const;
+	bool read(const ArchiveMember &member,
+	    AcctVector<std::byte, M_INFLATE> &out) const;
+};
+
+/* whether path is a file that looks like a tar or gzip archive */
+bool is_archive(const std::string &path);
+
+/*
+ * split archive:member at the first colon following an existing archive,
+ * false when path names no member of an archive
+ */
+bool split_archive_path(const std::string &path, std::string &archive,
+    std::string &member);
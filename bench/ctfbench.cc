@@ -0,0 +1,259 @@
+/*
+ * ctfbench times the phases of ctfdiff on pairs of files, normally made
+ * by ctfgen, and writes the results as JSON. Given the results of an
+ * earlier run it fails when throughput or peak RSS regressed.
+ */
+
+#include <sys/resource.h>
+
+#include <getopt.h>
+#include <libelf.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include "ctfdata.hpp"
+#include "fingerprint.hpp"
+#include "metadata.hpp"
+#include "utility.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+enum BenchPhase {
+	B_OPEN,	       /* open the files and find the section */
+	B_PARSE,       /* inflate and parse */
+	B_COMPARE,     /* the report of a diff */
+	B_FINGERPRINT, /* the fingerprints of both files */
+	B_PHASE_MAX,
+};
+
+static const char *phase_names[B_PHASE_MAX] = { "open", "parse", "compare",
+	"fingerprint" };
+
+struct PairResult {
+	std::string lhs, rhs;
+	size_t ctf_bytes = 0; /* inflated CTF of both files */
+	std::vector<double> ms[B_PHASE_MAX];
+
+	double median(int phase) const
+	{
+		std::vector<double> v = ms[phase];
+
+		std::sort(v.begin(), v.end());
+		return (v.empty() ? 0 : v[v.size() / 2]);
+	}
+};
+
+using BenchClock = std::chrono::steady_clock;
+
+static double
+elapsed_ms(BenchClock::time_point start)
+{
+	return (std::chrono::duration<double, std::milli>(
+	    BenchClock::now() - start)
+		.count());
+}
+
+/* one run of every phase on a pair, false if a file can not be parsed */
+static bool
+run_pair(PairResult &res)
+{
+	auto start = BenchClock::now();
+	CtfMetaData lmeta(res.lhs), rmeta(res.rhs);
+
+	if (!lmeta.is_available() || !rmeta.is_available()) {
+		std::cout << "Cannot parse file "
+			  << (lmeta.is_available() ? res.rhs : res.lhs) << '\n';
+		return (false);
+	}
+	res.ctf_bytes = lmeta.resident_size() + rmeta.resident_size();
+	res.ms[B_OPEN].push_back(elapsed_ms(start));
+
+	start = BenchClock::now();
+	auto l_info = CtfData::create_ctf_info(std::move(lmeta));
+	auto r_info = CtfData::create_ctf_info(std::move(rmeta));
+	if (l_info == nullptr || r_info == nullptr)
+		return (false);
+	res.ms[B_PARSE].push_back(elapsed_ms(start));
+
+	std::ostringstream out;
+	start = BenchClock::now();
+	l_info->compare_and_get_diff(*r_info, out);
+	res.ms[B_COMPARE].push_back(elapsed_ms(start));
+
+	start = BenchClock::now();
+	CtfSymbolPrints::from_data(*l_info);
+	CtfSymbolPrints::from_data(*r_info);
+	res.ms[B_FINGERPRINT].push_back(elapsed_ms(start));
+
+	return (true);
+}
+
+static void
+write_json(std::ostream &out, const std::vector<PairResult> &results,
+    int runs, double mb_per_s, long peak_rss_kb)
+{
+	out << std::fixed << std::setprecision(3);
+	out << "{\n  \"runs\": " << runs << ",\n  \"pairs\": [";
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		const auto &r = results[i];
+
+		out << (i == 0 ? "\n" : ",\n") << "    { \"lhs\": \"" << r.lhs
+		    << "\", \"rhs\": \"" << r.rhs
+		    << "\", \"ctf_bytes\": " << r.ctf_bytes;
+		for (int p = 0; p < B_PHASE_MAX; ++p)
+			out << ", \"" << phase_names[p]
+			    << "_ms\": " << r.median(p);
+		out << " }";
+	}
+
+	out << "\n  ],\n  \"parse_mb_per_s\": " << mb_per_s
+	    << ",\n  \"peak_rss_kb\": " << peak_rss_kb << "\n}\n";
+}
+
+/* a top level number of a file written by write_json */
+static bool
+json_number(const std::string &json, const std::string &key, double &value)
+{
+	size_t pos = json.rfind("\"" + key + "\":");
+
+	if (pos == std::string::npos)
+		return (false);
+
+	value = strtod(json.c_str() + pos + key.size() + 3, NULL);
+	return (true);
+}
+
+/* fail when throughput dropped or RSS grew by more than tolerance percent */
+static bool
+check_baseline(const std::string &path, double tolerance, double mb_per_s,
+    long peak_rss_kb)
+{
+	std::ifstream in(path);
+	std::stringstream json;
+	double base_mb_per_s, base_rss_kb;
+	bool ok = true;
+
+	json << in.rdbuf();
+	if (!in || !json_number(json.str(), "parse_mb_per_s", base_mb_per_s) ||
+	    !json_number(json.str(), "peak_rss_kb", base_rss_kb)) {
+		std::cout << "Cannot read results " << path << '\n';
+		return (false);
+	}
+
+	if (mb_per_s < base_mb_per_s * (1 - tolerance / 100)) {
+		std::cout << "parse throughput regressed: " << mb_per_s
+			  << " MB/s, was " << base_mb_per_s << " MB/s\n";
+		ok = false;
+	}
+
+	if (peak_rss_kb > base_rss_kb * (1 + tolerance / 100)) {
+		std::cout << "peak RSS regressed: " << peak_rss_kb
+			  << " KB, was " << base_rss_kb << " KB\n";
+		ok = false;
+	}
+
+	return (ok);
+}
+
+static struct option longopts[] = {
+	{ "runs", required_argument, NULL, 'n' },
+	{ "output", required_argument, NULL, 'o' },
+	{ "baseline", required_argument, NULL, 'b' },
+	{ "tolerance", required_argument, NULL, 't' },
+	{ "f-ignore-const", no_argument, NULL, 'c' }, { NULL, 0, NULL, 0 }
+};
+
+static void
+print_usage()
+{
+	std::cout << "usage: ctfbench [-runs n] [-output file] "
+		     "[-baseline file [-tolerance percent]]\n"
+		     "                [-f-ignore-const] lhs rhs ...\n";
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *output = nullptr, *baseline = nullptr;
+	std::vector<PairResult> results;
+	double tolerance = 10, parse_ms = 0, bytes = 0;
+	int c, runs = 5;
+	struct rusage ru;
+
+	(void)elf_version(EV_CURRENT);
+
+	while ((c = getopt_long_only(argc, argv, "n:o:b:t:c", longopts,
+		    NULL)) != -1) {
+		switch (c) {
+		case 'n':
+			runs = std::max(1, atoi(optarg));
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'b':
+			baseline = optarg;
+			break;
+		case 't':
+			tolerance = atof(optarg);
+			break;
+		case 'c':
+			flags |= F_IGNORE_CONST;
+			ignore_ids.push_back(&typeid(CtfTypeConst));
+			break;
+		default:
+			print_usage();
+			return (EX_USAGE);
+		}
+	}
+
+	if (optind == argc || (argc - optind) % 2 != 0) {
+		print_usage();
+		return (EX_USAGE);
+	}
+
+	for (int i = optind; i < argc; i += 2) {
+		PairResult res;
+
+		res.lhs = argv[i];
+		res.rhs = argv[i + 1];
+		for (int run = 0; run < runs; ++run)
+			if (!run_pair(res))
+				return (1);
+
+		parse_ms += res.median(B_PARSE);
+		bytes += res.ctf_bytes;
+		results.push_back(std::move(res));
+	}
+
+	getrusage(RUSAGE_SELF, &ru);
+
+	double mb_per_s = parse_ms > 0 ? bytes / (1 << 20) / (parse_ms / 1000) :
+					 0;
+
+	if (output != nullptr) {
+		std::ofstream out(output);
+
+		write_json(out, results, runs, mb_per_s, ru.ru_maxrss);
+		if (!out) {
+			std::cout << "Cannot write " << output << '\n';
+			return (1);
+		}
+	} else {
+		write_json(std::cout, results, runs, mb_per_s, ru.ru_maxrss);
+	}
+
+	if (baseline != nullptr &&
+	    !check_baseline(baseline, tolerance, mb_per_s, ru.ru_maxrss))
+		return (1);
+
+	return (0);
+}
@@ -0,0 +1,510 @@
+/*
+ * ctfgen writes a synthetic .SUNW_ctf section, either raw or inside an
+ * ELF64 relocatable object, for benchmarking ctfdiff on inputs of a known
+ * shape. The same seed always gives the same file, -mutate changes a part
+ * of the structs so that two files of a pair differ.
+ */
+
+#include <sys/endian.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <gelf.h>
+#include <getopt.h>
+#include <libelf.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "sys/ctf.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* the shape of the generated CTF */
+struct GenConfig {
+	int version = CTF_VERSION_3;
+	uint32_t structs = 1000;  /* number of structs */
+	uint32_t members = 8;	  /* members of each struct */
+	uint32_t cycles = 20;	  /* percent of members pointing to a struct */
+	uint32_t qualifiers = 2;  /* qualifiers between a member and a pointer */
+	uint32_t functions = 500; /* function symbols */
+	uint32_t variables = 500; /* data symbols */
+	uint32_t args = 3;	  /* arguments of each function */
+	uint32_t mutate = 0;	  /* percent of structs changed */
+	uint64_t seed = 1;
+	bool compress = false;
+	bool raw = false;
+	bool big_endian = false; /* as a powerpc64 target */
+};
+
+/* base types, then for each struct its record, a pointer and qualifiers */
+#define GEN_INT 1
+#define GEN_LONG 2
+#define GEN_CHAR 3
+#define GEN_FIRST_STRUCT 4
+
+struct CtfGen {
+	const GenConfig &cfg;
+	std::string types, strs;
+	std::unordered_map<std::string, uint32_t> str_offsets;
+	std::mt19937_64 rng;
+
+	CtfGen(const GenConfig &cfg)
+	    : cfg(cfg)
+	    , strs(1, '\0')
+	    , rng(cfg.seed) {};
+
+	bool v2() const { return (cfg.version == CTF_VERSION_2); }
+	size_t id_width() const { return (v2() ? 2 : 4); }
+	uint32_t block() const { return (2 + cfg.qualifiers); }
+	uint32_t struct_id(uint32_t i) const
+	{
+		return (GEN_FIRST_STRUCT + i * block());
+	}
+	/* the outermost qualifier of the pointer to struct i */
+	uint32_t pointer_id(uint32_t i) const
+	{
+		return (struct_id(i) + 1 + cfg.qualifiers);
+	}
+	uint32_t last_id() const { return (struct_id(cfg.structs) - 1); }
+
+	uint32_t str(const std::string &s);
+	uint32_t random(uint32_t n) { return (rng() % n); }
+	void put(uint64_t v, size_t width);
+	void put_id(uint32_t id) { put(id, id_width()); }
+	uint32_t info(int kind, uint32_t vlen) const;
+	void put_type(const std::string &name, int kind, uint32_t vlen,
+	    uint64_t size_or_type);
+	uint32_t member_type(uint32_t k, bool changed);
+	void gen_types();
+	std::string gen_symbols(std::vector<std::string> &objects,
+	    std::vector<std::string> &funcs);
+	std::string section(std::vector<std::string> &objects,
+	    std::vector<std::string> &funcs);
+};
+
+uint32_t
+CtfGen::str(const std::string &s)
+{
+	auto [iter, added] = str_offsets.emplace(s, strs.size());
+
+	if (added)
+		strs.append(s.c_str(), s.size() + 1);
+
+	return (iter->second);
+}
+
+/* little endian as on the machines the corpus is generated for, or big */
+void
+CtfGen::put(uint64_t v, size_t width)
+{
+	for (size_t i = 0; i < width; ++i)
+		types.push_back(static_cast<char>(
+		    v >> (8 * (cfg.big_endian ? width - 1 - i : i))));
+}
+
+uint32_t
+CtfGen::info(int kind, uint32_t vlen) const
+{
+	return (v2() ? CTF_V2_TYPE_INFO(kind, 1, vlen) :
+		       CTF_V3_TYPE_INFO(kind, 1, vlen));
+}
+
+void
+CtfGen::put_type(const std::string &name, int kind, uint32_t vlen,
+    uint64_t size_or_type)
+{
+	uint64_t max = v2() ? CTF_V2_MAX_SIZE : CTF_V3_MAX_SIZE;
+	uint64_t sent = v2() ? CTF_V2_LSIZE_SENT : CTF_V3_LSIZE_SENT;
+	bool lsize = (kind == CTF_K_STRUCT || kind == CTF_K_UNION) &&
+	    size_or_type > max;
+
+	put(str(name), 4);
+	put(info(kind, vlen), id_width());
+	put(lsize ? sent : size_or_type, id_width());
+	if (lsize) {
+		put(CTF_SIZE_TO_LSIZE_HI(size_or_type), 4);
+		put(CTF_SIZE_TO_LSIZE_LO(size_or_type), 4);
+	}
+}
+
+/*
+ * a member is a pointer to a random struct, closing cycles, or a base
+ * type. A changed struct turns its last member into a long, after the
+ * random numbers are drawn as for any struct, so the structs following it
+ * come out the same as in an unchanged file.
+ */
+uint32_t
+CtfGen::member_type(uint32_t k, bool changed)
+{
+	uint32_t type = random(100) < cfg.cycles ?
+	    pointer_id(random(cfg.structs)) :
+	    (random(2) == 0 ? GEN_INT : GEN_CHAR);
+
+	return (changed && k == cfg.members - 1 ? GEN_LONG : type);
+}
+
+void
+CtfGen::gen_types()
+{
+	std::mt19937_64 mutation(cfg.seed ^ 0x9e3779b97f4a7c15ULL);
+	uint64_t size = 8ULL * cfg.members;
+	bool lmember = size >=
+	    (v2() ? CTF_V2_LSTRUCT_THRESH : CTF_V3_LSTRUCT_THRESH);
+	static const int qualifiers[] = { CTF_K_CONST, CTF_K_VOLATILE,
+		CTF_K_TYPEDEF, CTF_K_RESTRICT };
+
+	put_type("int", CTF_K_INTEGER, 0, 4);
+	put(CTF_INT_DATA(CTF_INT_SIGNED, 0, 32), 4);
+	put_type("long", CTF_K_INTEGER, 0, 8);
+	put(CTF_INT_DATA(CTF_INT_SIGNED, 0, 64), 4);
+	put_type("char", CTF_K_INTEGER, 0, 1);
+	put(CTF_INT_DATA(CTF_INT_SIGNED | CTF_INT_CHAR, 0, 8), 4);
+
+	for (uint32_t i = 0; i < cfg.structs; ++i) {
+		bool changed = mutation() % 100 < cfg.mutate;
+
+		put_type("s" + std::to_string(i), CTF_K_STRUCT, cfg.members,
+		    size);
+		for (uint32_t k = 0; k < cfg.members; ++k) {
+			uint32_t name = str("m" + std::to_string(k));
+			uint32_t type = member_type(k, changed);
+			uint64_t offset = 64ULL * k;
+
+			put(name, 4);
+			put(type, id_width());
+			if (lmember) {
+				if (v2())
+					put(0, 2);
+				put(CTF_OFFSET_TO_LMEMHI(offset), 4);
+				put(CTF_OFFSET_TO_LMEMLO(offset), 4);
+			} else {
+				put(offset, id_width());
+			}
+		}
+
+		put_type("", CTF_K_POINTER, 0, struct_id(i));
+		for (uint32_t q = 0; q < cfg.qualifiers; ++q) {
+			int kind = qualifiers[q % 4];
+			std::string name = kind == CTF_K_TYPEDEF ?
+			    "t" + std::to_string(i) + "_" + std::to_string(q) :
+			    "";
+
+			put_type(name, kind, 0, struct_id(i) + 1 + q);
+		}
+	}
+}
+
+/* the data and function sections, the symbols are named in order */
+std::string
+CtfGen::gen_symbols(std::vector<std::string> &objects,
+    std::vector<std::string> &funcs)
+{
+	std::string saved;
+	std::string res;
+
+	/* put() appends to types, borrow it */
+	saved.swap(types);
+
+	for (uint32_t i = 0; i < cfg.variables; ++i) {
+		objects.push_back("v" + std::to_string(i));
+		put_id(random(2) == 0 ? struct_id(random(cfg.structs)) :
+					pointer_id(random(cfg.structs)));
+	}
+
+	for (uint32_t i = 0; i < cfg.functions; ++i) {
+		funcs.push_back("f" + std::to_string(i));
+		put(info(CTF_K_FUNCTION, cfg.args), id_width());
+		put_id(GEN_INT);
+		for (uint32_t a = 0; a < cfg.args; ++a)
+			put_id(pointer_id(random(cfg.structs)));
+	}
+
+	res.swap(types);
+	types.swap(saved);
+	return (res);
+}
+
+std::string
+CtfGen::section(std::vector<std::string> &objects,
+    std::vector<std::string> &funcs)
+{
+	ctf_header_t header;
+	std::string body;
+
+	gen_types();
+
+	std::string symbols = gen_symbols(objects, funcs);
+	size_t objtlen = cfg.variables * id_width();
+
+	memset(&header, 0, sizeof(header));
+	header.cth_magic = CTF_MAGIC;
+	header.cth_version = cfg.version;
+	header.cth_objtoff = 0;
+	header.cth_funcoff = objtlen;
+	header.cth_typeoff = (symbols.size() + 3) & ~3;
+	header.cth_stroff = header.cth_typeoff + types.size();
+	header.cth_strlen = strs.size();
+
+	body = symbols;
+	body.resize(header.cth_typeoff);
+	body += types;
+	body += strs;
+
+	if (cfg.compress) {
+		uLongf len = compressBound(body.size());
+		std::string out(len, '\0');
+
+		if (compress2(reinterpret_cast<Bytef *>(out.data()), &len,
+			reinterpret_cast<const Bytef *>(body.data()),
+			body.size(), Z_BEST_SPEED) != Z_OK)
+			errx(EX_SOFTWARE, "compress2 failed");
+		out.resize(len);
+		body.swap(out);
+		header.cth_flags |= CTF_F_COMPRESS;
+	}
+
+	if (cfg.big_endian) {
+		header.cth_magic = bswap16(header.cth_magic);
+		header.cth_parlabel = bswap32(header.cth_parlabel);
+		header.cth_parname = bswap32(header.cth_parname);
+		header.cth_lbloff = bswap32(header.cth_lbloff);
+		header.cth_objtoff = bswap32(header.cth_objtoff);
+		header.cth_funcoff = bswap32(header.cth_funcoff);
+		header.cth_typeoff = bswap32(header.cth_typeoff);
+		header.cth_stroff = bswap32(header.cth_stroff);
+		header.cth_strlen = bswap32(header.cth_strlen);
+	}
+
+	return (std::string(reinterpret_cast<char *>(&header),
+		    sizeof(header)) +
+	    body);
+}
+
+static void
+add_section(Elf *elf, size_t name, uint32_t type, const std::string *contents,
+    uint64_t size, uint32_t link, uint32_t info, uint64_t entsize)
+{
+	Elf_Scn *scn = elf_newscn(elf);
+	GElf_Shdr shdr;
+
+	if (scn == NULL || gelf_getshdr(scn, &shdr) == NULL)
+		errx(EX_SOFTWARE, "elf_newscn: %s", elf_errmsg(-1));
+
+	shdr.sh_name = name;
+	shdr.sh_type = type;
+	shdr.sh_link = link;
+	shdr.sh_info = info;
+	shdr.sh_entsize = entsize;
+	shdr.sh_addralign = 8;
+	shdr.sh_size = size;
+
+	if (contents != nullptr) {
+		Elf_Data *data = elf_newdata(scn);
+
+		data->d_buf = const_cast<char *>(contents->data());
+		data->d_size = contents->size();
+		/* libelf writes the symbols in the order of the file */
+		data->d_type = type == SHT_SYMTAB ? ELF_T_SYM : ELF_T_BYTE;
+		data->d_align = shdr.sh_addralign;
+	}
+
+	if (gelf_update_shdr(scn, &shdr) == 0)
+		errx(EX_SOFTWARE, "gelf_update_shdr: %s", elf_errmsg(-1));
+}
+
+/*
+ * sections: .bss holding the symbols, .SUNW_ctf linked to .symtab, its
+ * .strtab and .shstrtab
+ */
+static void
+write_elf(int fd, bool big_endian, const std::string &ctf,
+    const std::vector<std::string> &objects,
+    const std::vector<std::string> &funcs)
+{
+	std::string shstrtab(1, '\0'), strtab(1, '\0'), symtab;
+	GElf_Ehdr ehdr;
+	Elf *elf;
+
+	auto name = [&](const char *str) {
+		size_t off = shstrtab.size();
+
+		shstrtab.append(str, strlen(str) + 1);
+		return (off);
+	};
+	size_t bss_name = name(".bss"), ctf_name = name(".SUNW_ctf");
+	size_t symtab_name = name(".symtab"), strtab_name = name(".strtab");
+	size_t shstrtab_name = name(".shstrtab");
+
+	/* symbol 0 is the null symbol, then objects and functions */
+	auto add_symbol = [&](const std::string &name, int type, size_t i) {
+		Elf64_Sym sym;
+
+		memset(&sym, 0, sizeof(sym));
+		sym.st_name = strtab.size();
+		sym.st_info = ELF64_ST_INFO(STB_GLOBAL, type);
+		sym.st_shndx = 1;
+		sym.st_value = 8 * i;
+		sym.st_size = 8;
+		strtab.append(name.c_str(), name.size() + 1);
+		symtab.append(reinterpret_cast<char *>(&sym), sizeof(sym));
+	};
+
+	symtab.assign(sizeof(Elf64_Sym), '\0');
+	for (size_t i = 0; i < objects.size(); ++i)
+		add_symbol(objects[i], STT_OBJECT, i);
+	for (size_t i = 0; i < funcs.size(); ++i)
+		add_symbol(funcs[i], STT_FUNC, objects.size() + i);
+
+	if ((elf = elf_begin(fd, ELF_C_WRITE, NULL)) == NULL ||
+	    gelf_newehdr(elf, ELFCLASS64) == 0 ||
+	    gelf_getehdr(elf, &ehdr) == NULL)
+		errx(EX_SOFTWARE, "elf_begin: %s", elf_errmsg(-1));
+
+	ehdr.e_ident[EI_DATA] = big_endian ? ELFDATA2MSB : ELFDATA2LSB;
+	ehdr.e_type = ET_REL;
+	ehdr.e_machine = big_endian ? EM_PPC64 : EM_X86_64;
+	ehdr.e_version = EV_CURRENT;
+	ehdr.e_shstrndx = 5;
+
+	add_section(elf, bss_name, SHT_NOBITS, nullptr,
+	    8 * (objects.size() + funcs.size()), 0, 0, 0);
+	add_section(elf, ctf_name, SHT_PROGBITS, &ctf, ctf.size(), 3, 0, 0);
+	add_section(elf, symtab_name, SHT_SYMTAB, &symtab, symtab.size(), 4,
+	    1, sizeof(Elf64_Sym));
+	add_section(elf, strtab_name, SHT_STRTAB, &strtab, strtab.size(), 0,
+	    0, 0);
+	add_section(elf, shstrtab_name, SHT_STRTAB, &shstrtab,
+	    shstrtab.size(), 0, 0, 0);
+
+	if (gelf_update_ehdr(elf, &ehdr) == 0 ||
+	    elf_update(elf, ELF_C_WRITE) < 0)
+		errx(EX_SOFTWARE, "elf_update: %s", elf_errmsg(-1));
+
+	elf_end(elf);
+}
+
+static struct option longopts[] = {
+	{ "version", required_argument, NULL, 'v' },
+	{ "structs", required_argument, NULL, 's' },
+	{ "members", required_argument, NULL, 'm' },
+	{ "cycles", required_argument, NULL, 'y' },
+	{ "qualifiers", required_argument, NULL, 'q' },
+	{ "functions", required_argument, NULL, 'f' },
+	{ "variables", required_argument, NULL, 'o' },
+	{ "args", required_argument, NULL, 'a' },
+	{ "mutate", required_argument, NULL, 'u' },
+	{ "seed", required_argument, NULL, 'S' },
+	{ "compress", no_argument, NULL, 'z' },
+	{ "raw", no_argument, NULL, 'r' },
+	{ "big-endian", no_argument, NULL, 'B' }, { NULL, 0, NULL, 0 }
+};
+
+static void
+print_usage()
+{
+	std::cout << "usage: ctfgen [-version 2|3] [-structs n] [-members n] "
+		     "[-cycles percent]\n"
+		     "              [-qualifiers n] [-functions n] "
+		     "[-variables n] [-args n]\n"
+		     "              [-mutate percent] [-seed n] [-compress] "
+		     "[-raw]\n"
+		     "              [-big-endian] file\n";
+}
+
+int
+main(int argc, char *argv[])
+{
+	std::vector<std::string> objects, funcs;
+	GenConfig cfg;
+	int c, fd;
+
+	(void)elf_version(EV_CURRENT);
+
+	while ((c = getopt_long_only(argc, argv, "v:s:m:y:q:f:o:a:u:S:zrB",
+		    longopts, NULL)) != -1) {
+		switch (c) {
+		case 'v':
+			cfg.version = atoi(optarg);
+			break;
+		case 's':
+			cfg.structs = std::max(1, atoi(optarg));
+			break;
+		case 'm':
+			cfg.members = std::max(1, atoi(optarg));
+			break;
+		case 'y':
+			cfg.cycles = atoi(optarg);
+			break;
+		case 'q':
+			cfg.qualifiers = atoi(optarg);
+			break;
+		case 'f':
+			cfg.functions = atoi(optarg);
+			break;
+		case 'o':
+			cfg.variables = atoi(optarg);
+			break;
+		case 'a':
+			cfg.args = atoi(optarg);
+			break;
+		case 'u':
+			cfg.mutate = atoi(optarg);
+			break;
+		case 'S':
+			cfg.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'z':
+			cfg.compress = true;
+			break;
+		case 'r':
+			cfg.raw = true;
+			break;
+		case 'B':
+			cfg.big_endian = true;
+			break;
+		default:
+			print_usage();
+			return (EX_USAGE);
+		}
+	}
+
+	if (optind != argc - 1 ||
+	    (cfg.version != CTF_VERSION_2 && cfg.version != CTF_VERSION_3)) {
+		print_usage();
+		return (EX_USAGE);
+	}
+
+	CtfGen gen(cfg);
+
+	if (cfg.version == CTF_VERSION_2 &&
+	    (gen.last_id() > CTF_V2_MAX_PTYPE ||
+		cfg.members > CTF_V2_MAX_VLEN || cfg.args > CTF_V2_MAX_VLEN))
+		errx(EX_USAGE, "too many types or members for CTF version 2");
+
+	std::string ctf = gen.section(objects, funcs);
+
+	if ((fd = open(argv[optind], O_WRONLY | O_CREAT | O_TRUNC, 0644)) ==
+	    -1)
+		err(EX_CANTCREAT, "%s", argv[optind]);
+
+	if (cfg.raw) {
+		if (write(fd, ctf.data(), ctf.size()) !=
+		    static_cast<ssize_t>(ctf.size()))
+			err(EX_IOERR, "%s", argv[optind]);
+	} else {
+		write_elf(fd, cfg.big_endian, ctf, objects, funcs);
+	}
+
+	close(fd);
+	return (0);
+}
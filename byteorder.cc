@@ -0,0 +1,221 @@
+#include <sys/endian.h>
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "byteorder.hpp"
+#include "ctftype.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * 16 bytes at a time with SSE2, which every amd64 has, or NEON. The words
+ * left over, and all of them elsewhere, are swapped one by one.
+ */
+static size_t
+bswap16_vector(std::byte *data, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	for (; i + 8 <= n; i += 8) {
+		__m128i *p = reinterpret_cast<__m128i *>(data + 2 * i);
+		__m128i v = _mm_loadu_si128(p);
+
+		_mm_storeu_si128(p,
+		    _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 8 <= n; i += 8) {
+		uint8_t *p = reinterpret_cast<uint8_t *>(data + 2 * i);
+
+		vst1q_u8(p, vrev16q_u8(vld1q_u8(p)));
+	}
+#endif
+
+	return (i);
+}
+
+static size_t
+bswap32_vector(std::byte *data, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	/* swap the bytes of each half, then the halves of each word */
+	for (; i + 4 <= n; i += 4) {
+		__m128i *p = reinterpret_cast<__m128i *>(data + 4 * i);
+		__m128i v = _mm_loadu_si128(p);
+
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		_mm_storeu_si128(p, v);
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 4 <= n; i += 4) {
+		uint8_t *p = reinterpret_cast<uint8_t *>(data + 4 * i);
+
+		vst1q_u8(p, vrev32q_u8(vld1q_u8(p)));
+	}
+#endif
+
+	return (i);
+}
+
+void
+ctf_bswap16(std::byte *data, size_t n)
+{
+	for (size_t i = bswap16_vector(data, n); i < n; ++i) {
+		uint16_t v;
+
+		memcpy(&v, data + i * sizeof(v), sizeof(v));
+		v = bswap16(v);
+		memcpy(data + i * sizeof(v), &v, sizeof(v));
+	}
+}
+
+void
+ctf_bswap32(std::byte *data, size_t n)
+{
+	for (size_t i = bswap32_vector(data, n); i < n; ++i) {
+		uint32_t v;
+
+		memcpy(&v, data + i * sizeof(v), sizeof(v));
+		v = bswap32(v);
+		memcpy(data + i * sizeof(v), &v, sizeof(v));
+	}
+}
+
+void
+ctf_swap_header(ctf_header_t *header)
+{
+	header->cth_magic = bswap16(header->cth_magic);
+	header->cth_parlabel = bswap32(header->cth_parlabel);
+	header->cth_parname = bswap32(header->cth_parname);
+	header->cth_lbloff = bswap32(header->cth_lbloff);
+	header->cth_objtoff = bswap32(header->cth_objtoff);
+	header->cth_funcoff = bswap32(header->cth_funcoff);
+	header->cth_typeoff = bswap32(header->cth_typeoff);
+	header->cth_stroff = bswap32(header->cth_stroff);
+	header->cth_strlen = bswap32(header->cth_strlen);
+}
+
+#define SWAP16(p, type, field) ctf_bswap16((p) + offsetof(type, field), 1)
+#define SWAP32(p, type, field) ctf_bswap32((p) + offsetof(type, field), 1)
+
+/*
+ * one CTFv2 record, whose fields are of mixed widths. Returns its length,
+ * 0 if it does not fit in left bytes.
+ */
+static size_t
+swap_type_v2(std::byte *p, size_t left)
+{
+	if (left < sizeof(struct ctf_stype_v2))
+		return (0);
+
+	SWAP32(p, struct ctf_stype_v2, ctt_name);
+	SWAP16(p, struct ctf_stype_v2, ctt_info);
+	SWAP16(p, struct ctf_stype_v2, ctt_size);
+
+	uint16_t size;
+
+	memcpy(&size, p + offsetof(struct ctf_stype_v2, ctt_size),
+	    sizeof(size));
+	if (size == CtfV2::lsize_sent) {
+		if (left < sizeof(struct ctf_type_v2))
+			return (0);
+		SWAP32(p, struct ctf_type_v2, ctt_lsizehi);
+		SWAP32(p, struct ctf_type_v2, ctt_lsizelo);
+	}
+
+	CtfRecord<CtfV2> rec(p);
+	std::byte *var = p + rec.increment();
+	size_t len = rec.increment() + rec.vlen_bytes();
+
+	if (len > left)
+		return (0);
+
+	switch (rec.kind()) {
+	case CTF_K_INTEGER:
+	case CTF_K_FLOAT:
+		ctf_bswap32(var, 1);
+		break;
+	case CTF_K_ARRAY:
+		SWAP16(var, struct ctf_array_v2, cta_contents);
+		SWAP16(var, struct ctf_array_v2, cta_index);
+		SWAP32(var, struct ctf_array_v2, cta_nelems);
+		break;
+	case CTF_K_FUNCTION:
+		ctf_bswap16(var, rec.vlen());
+		break;
+	case CTF_K_STRUCT:
+	case CTF_K_UNION:
+		for (ulong_t i = 0; i < rec.vlen(); ++i) {
+			if (rec.size() >= CtfV2::lstruct_thresh) {
+				std::byte *m = var +
+				    i * sizeof(struct ctf_lmember_v2);
+
+				SWAP32(m, struct ctf_lmember_v2, ctlm_name);
+				SWAP16(m, struct ctf_lmember_v2, ctlm_type);
+				SWAP32(m, struct ctf_lmember_v2,
+				    ctlm_offsethi);
+				SWAP32(m, struct ctf_lmember_v2,
+				    ctlm_offsetlo);
+			} else {
+				std::byte *m = var +
+				    i * sizeof(struct ctf_member_v2);
+
+				SWAP32(m, struct ctf_member_v2, ctm_name);
+				SWAP16(m, struct ctf_member_v2, ctm_type);
+				SWAP16(m, struct ctf_member_v2, ctm_offset);
+			}
+		}
+		break;
+	case CTF_K_ENUM:
+		ctf_bswap32(var, 2 * rec.vlen());
+		break;
+	}
+
+	return (len);
+}
+
+#undef SWAP16
+#undef SWAP32
+
+void
+ctf_swap_section(const ctf_header_t *header, std::byte *data, size_t size)
+{
+	size_t end = std::min<size_t>(header->cth_stroff, size);
+
+	if (header->cth_lbloff > end)
+		return;
+
+	/* every field of CTFv3 before the strings is 32 bits wide */
+	if (header->cth_version == CTF_VERSION_3) {
+		ctf_bswap32(data + header->cth_lbloff,
+		    (end - header->cth_lbloff) / sizeof(uint32_t));
+		return;
+	}
+
+	/* labels, then ids and the info of functions, then the types */
+	if (header->cth_objtoff > end || header->cth_typeoff > end ||
+	    header->cth_lbloff > header->cth_objtoff ||
+	    header->cth_objtoff > header->cth_typeoff)
+		return;
+
+	ctf_bswap32(data + header->cth_lbloff,
+	    (header->cth_objtoff - header->cth_lbloff) / sizeof(uint32_t));
+	ctf_bswap16(data + header->cth_objtoff,
+	    (header->cth_typeoff - header->cth_objtoff) / sizeof(uint16_t));
+
+	for (size_t off = header->cth_typeoff, len; off < end; off += len)
+		if ((len = swap_type_v2(data + off, end - off)) == 0)
+			break;
+}
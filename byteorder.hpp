@@ -0,0 +1,34 @@
+#pragma once
+
+#include <sys/endian.h>
+
+#include "ctf_headers.h"
+#include "sys/ctf.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * CTF written on a machine of the other byte order, such as the kernel of
+ * a big endian target converted on a little endian host, starts with a
+ * swapped magic. Its header and regions are swapped to native order once,
+ * in bulk where a region is an array of one width, so that the parse loops
+ * never look at the byte order.
+ */
+
+static constexpr uint16_t CTF_SWAPPED_MAGIC = bswap16(CTF_MAGIC);
+
+/* swap n 16 or 32 bit words in place, data need not be aligned */
+void ctf_bswap16(std::byte *data, size_t n);
+void ctf_bswap32(std::byte *data, size_t n);
+
+/* the fields of a header read from a foreign section */
+void ctf_swap_header(ctf_header_t *header);
+
+/*
+ * the regions of a section in place. header is already native, data and
+ * size exclude it. A record that does not fit stops the swap, the section
+ * is then rejected by the checks of validate.hpp.
+ */
+void ctf_swap_section(const ctf_header_t *header, std::byte *data,
+    size_t size);
@@ -17,17 +17,30 @@
 #include "sys/ctf.h"
 #include "sys/elf_common.h"
 
+#include "byteorder.hpp"
 #include "ctfdata.hpp"
 #include "ctftype.hpp"
+#include "fingerprint.hpp"
+#include "hash.hpp"
 #include "metadata.hpp"
+#include "probes.hpp"
+#include "stats.hpp"
 #include "utility.hpp"
+#include "validate.hpp"
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <filesystem>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
 #include <string_view>
+#include <tuple>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
@@ -65,10 +78,11 @@ bool CtfData::zlib_decompress()
 	int rc;
 	size_t buffer_size = header->cth_stroff + header->cth_strlen;
 
-	buffer = new std::byte[buffer_size];
+	buffer = metadata.inflate_buffer(buffer_size);
 
 	bzero((void *)&zs, sizeof(zs));
-	zs.next_in = reinterpret_cast<Bytef *>(metadata.ctfdata.data);
+	zs.next_in = reinterpret_cast<Bytef *>(
+		const_cast<std::byte *>(metadata.ctfdata.data));
 	zs.avail_in = metadata.ctfdata.size;
 	zs.next_out = reinterpret_cast<Bytef *>(buffer);
 	zs.avail_out = buffer_size;
@@ -84,6 +98,7 @@ bool CtfData::zlib_decompress()
 	{
 		std::cout << "failed to decompress CTF data: " << zError(rc)
 				  << '\n';
+		inflateEnd(&zs);
 		return (false);
 	}
 
@@ -106,31 +121,26 @@ bool CtfData::zlib_decompress()
 	return (true);
 }
 
-CtfTypeFactory
-CtfData::get_type_factory()
-{
-	return header->cth_version == CTF_VERSION_2 ? &CtfTypeParser_V2::create_symbol : &CtfTypeParser_V3::create_symbol;
-}
-
 CtfData::CtfData(CtfMetaData &&metadata)
-	: metadata(metadata)
+	: metadata(std::move(metadata))
 {
 	Buffer &ctf_buffer = this->metadata.ctfdata;
 	this->header = nullptr;
 
 	if (ctf_buffer.size < sizeof(ctf_preamble_t))
 	{
-		std::cout << metadata.file_name()
+		std::cout << this->metadata.file_name()
 				  << " does not contain a CTF preamble\n";
 		return;
 	}
 
-	const ctf_preamble_t *preamble = reinterpret_cast<ctf_preamble_t *>(
+	const ctf_preamble_t *preamble = reinterpret_cast<const ctf_preamble_t *>(
 		ctf_buffer.data);
+	bool foreign = preamble->ctp_magic == CTF_SWAPPED_MAGIC;
 
-	if (preamble->ctp_magic != CTF_MAGIC)
+	if (preamble->ctp_magic != CTF_MAGIC && !foreign)
 	{
-		std::cout << metadata.file_name()
+		std::cout << this->metadata.file_name()
 				  << " does not contain a valid ctf data\n";
 		return;
 	}
@@ -145,29 +155,142 @@ CtfData::CtfData(CtfMetaData &&metadata)
 
 	if (ctf_buffer.size < sizeof(ctf_header_t))
 	{
-		std::cout << "File " << metadata.file_name()
+		std::cout << "File " << this->metadata.file_name()
 				  << " contains invalid CTF header\n";
 		return;
 	}
 
-	this->ctf_id_width = preamble->ctp_version == CTF_VERSION_2 ? 2 : 4;
-	this->header = reinterpret_cast<ctf_header_t *>(ctf_buffer.data);
+	if (foreign)
+	{
+		memcpy(&swapped_header, ctf_buffer.data, sizeof(swapped_header));
+		ctf_swap_header(&swapped_header);
+		this->header = &swapped_header;
+	}
+	else
+		this->header = reinterpret_cast<const ctf_header_t *>(
+			ctf_buffer.data);
 	ctf_buffer.data += sizeof(ctf_header_t);
+	ctf_buffer.size -= sizeof(ctf_header_t);
 
 	if (header->cth_flags & CTF_F_COMPRESS)
 	{
-		if (!zlib_decompress())
+		CtfPhaseTimer timer(P_INFLATE);
+		bool done;
+
+		CTFDIFF_INFLATE_START(probe_str(this->metadata.file_name()),
+							  ctf_buffer.size);
+		done = zlib_decompress();
+		CTFDIFF_INFLATE_DONE(probe_str(this->metadata.file_name()),
+							 done ? ctf_buffer.size : 0);
+
+		if (!done)
 		{
 			this->header = nullptr;
 			return;
 		}
 	}
 
+	std::string error;
+
+	if (!ctf_check_header(header, ctf_buffer.data, ctf_buffer.size, error))
+	{
+		std::cout << this->metadata.file_name() << " is corrupt: " << error
+				  << '\n';
+		this->header = nullptr;
+		return;
+	}
+
+	/* the checks and the parser only ever see native order */
+	if (foreign)
+		ctf_swap_section(header, this->metadata.writable_ctfdata(),
+						 ctf_buffer.size);
+
+	hash_regions();
+
 	return;
 }
 
+/* hash each region of the inflated section, its header is checked */
+void CtfData::hash_regions()
+{
+	const std::byte *data = metadata.ctfdata.data;
+	uint32_t bounds[] = {header->cth_objtoff, header->cth_funcoff,
+						 header->cth_typeoff, header->cth_stroff,
+						 header->cth_stroff + header->cth_strlen};
+
+	for (int i = 0; i < CTF_REGION_MAX; ++i)
+		region_hash[i] = ctf_hash(data + bounds[i],
+								  bounds[i + 1] - bounds[i], i + 1);
+}
+
+/*
+ * with identical type and string regions a type id means the same type on
+ * both sides, so symbols with equal ids need no graph comparison
+ */
+bool CtfData::same_types(const CtfData &rhs) const
+{
+	return (region_hash[CTF_REGION_TYPES] != 0 &&
+			region_hash[CTF_REGION_TYPES] ==
+				rhs.region_hash[CTF_REGION_TYPES] &&
+			region_hash[CTF_REGION_STRINGS] ==
+				rhs.region_hash[CTF_REGION_STRINGS] &&
+			header->cth_version == rhs.header->cth_version &&
+			header->cth_parname == rhs.header->cth_parname &&
+			(parent == rhs.parent ||
+			 (parent != nullptr && rhs.parent != nullptr &&
+			  parent->same_types(*rhs.parent))));
+}
+
 std::shared_ptr<CtfData>
 CtfData::create_ctf_info(CtfMetaData &&metadata)
+{
+	return (create(std::move(metadata), false));
+}
+
+/*
+ * parent containers, normally the CTF of the kernel, by path. A parent is
+ * parsed once and shared read-only by all children alive at the same time.
+ */
+static std::mutex parent_lock;
+static std::unordered_map<std::string, std::weak_ptr<CtfData>> parents;
+
+/*
+ * a parent is looked up by its name in the directory of the child, which
+ * is where the kernel is installed next to its modules
+ */
+void CtfData::load_parent()
+{
+	std::filesystem::path path(get_str_from_ref(header->cth_parname));
+
+	if (path.is_relative())
+		path = std::filesystem::path(std::string(metadata.file_name()))
+				   .parent_path() /
+			   path;
+	std::string key = path.lexically_normal().string();
+
+	std::lock_guard<std::mutex> guard(parent_lock);
+	auto &entry = parents[key];
+
+	if ((parent = entry.lock()) != nullptr)
+		return;
+
+	CtfMetaData parent_metadata(key);
+
+	if (parent_metadata.is_available())
+		parent = create(std::move(parent_metadata), true);
+
+	if (parent == nullptr)
+	{
+		std::cout << "Cannot load parent " << key << " of "
+				  << metadata.file_name() << '\n';
+		return;
+	}
+
+	entry = parent;
+}
+
+std::shared_ptr<CtfData>
+CtfData::create(CtfMetaData &&metadata, bool is_parent)
 {
 	auto res = std::shared_ptr<CtfData>(
 		new CtfData(std::forward<CtfMetaData &&>(metadata)));
@@ -177,9 +300,73 @@ CtfData::create_ctf_info(CtfMetaData &&metadata)
 		return nullptr;
 	}
 
-	do_parse_types(res);
-	do_parse_data(res);
-	do_parse_func(res);
+	/* the version is known from here on, each has its own parse loops */
+	if (res->header->cth_version == CTF_VERSION_2)
+		return (parse<CtfV2>(std::move(res), is_parent));
+	return (parse<CtfV3>(std::move(res), is_parent));
+}
+
+template <typename V>
+ShrCtfData CtfData::parse(ShrCtfData res, bool is_parent)
+{
+	res->decode_fn = &CtfData::decode_record<V>;
+
+	{
+		CtfPhaseTimer timer(P_TYPES);
+
+		if (!do_parse_types<V>(res))
+			return nullptr;
+	}
+
+	/* the symbols of an index are stored sorted */
+	if (res->metadata.index != nullptr)
+	{
+		CtfPhaseTimer timer(P_SYMBOLS);
+
+		if (!res->load_index())
+			return nullptr;
+	}
+	else
+	{
+		CtfPhaseTimer timer(P_SYMBOLS);
+		std::string error;
+
+		if (!ctf_check_symbols<V>(res->header, res->metadata.ctfdata.data,
+								  res->child_base,
+								  res->child_base + res->type_offsets.size(),
+								  error))
+		{
+			std::cout << res->metadata.file_name() << " is corrupt: "
+					  << error << '\n';
+			return nullptr;
+		}
+
+		do_parse_data<V>(res);
+		do_parse_func<V>(res);
+	}
+
+	/* -types and -layout look at every named type, parents serve anyone */
+	{
+		CtfPhaseTimer timer(P_TYPES);
+
+		if (symbol_globs.empty() || is_parent ||
+			(flags & (F_DIFF_TYPES | F_LAYOUT)) != 0)
+			res->decode_types();
+		else
+			res->decode_closure();
+	}
+
+	/* only one level of parents exists */
+	if (res->header->cth_parname != 0 && !is_parent)
+		res->load_parent();
+
+	if ((flags & F_LAYOUT) != 0)
+		res->resolve_layouts();
+
+	if (res->metadata.index != nullptr)
+		return (res);
+
+	CtfPhaseTimer timer(P_SORT);
 
 	std::sort(res->functions.begin(), res->functions.end(),
 			  [](const auto &lhs, const auto &rhs)
@@ -221,18 +408,19 @@ CtfData::find_next_symbol_with_type(int &idx, uchar_t type)
 	return ("");
 }
 
+template <typename V>
 bool CtfData::do_parse_data(ShrCtfData info)
 {
 	auto &header = info->header;
 	auto &metadata = info->metadata;
 	auto &static_variables = info->static_variables;
-	auto ctf_id_width = info->ctf_id_width;
+	constexpr size_t ctf_id_width = V::id_width;
 
 	const std::byte *iter = metadata.ctfdata.data + header->cth_objtoff;
 	ulong_t n = (header->cth_funcoff - header->cth_objtoff) / ctf_id_width;
 
 	int symidx, id;
-	uint32_t type_id;
+	uint32_t type_id = 0;
 	std::string_view name;
 
 	for (symidx = -1, id = 0; id < (int)n; ++id)
@@ -245,7 +433,7 @@ bool CtfData::do_parse_data(ShrCtfData info)
 
 		memcpy(&type_id, iter, ctf_id_width);
 		iter += ctf_id_width;
-		if (name != "")
+		if (name != "" && symbol_selected(name))
 			static_variables.push_back(
 				{name, type_id, static_cast<uint32_t>(id)});
 	}
@@ -253,219 +441,241 @@ bool CtfData::do_parse_data(ShrCtfData info)
 	return (true);
 }
 
+/* types are charged to M_TYPES, see memacct.hpp */
+template <typename T, typename... Args>
+static ShrCtfType make_type(Args &&...args)
+{
+	return (acct_make_shared<T, M_TYPES>(std::forward<Args>(args)...));
+}
+
+/*
+ * walk the type records once, checking them and remembering where each of
+ * them starts and indexing the named ones. The records themselves are
+ * decoded afterwards without further checks, all of them or only those
+ * reachable from the selected symbols.
+ */
+template <typename V>
 bool CtfData::do_parse_types(ShrCtfData info)
 {
-	auto &header = info->header;
 	auto &metadata = info->metadata;
-	auto &id_to_types = info->id_to_types;
-	const std::byte *iter = metadata.ctfdata.data + header->cth_typeoff;
-	const std::byte *end = metadata.ctfdata.data + header->cth_stroff;
-	auto ctf_id_width = info->ctf_id_width;
-	uint64_t id;
-	CtfTypeParser *(*type_factory)(const std::byte *);
-	size_t vlen, increment;
+	uint32_t last_id;
+	std::string error;
 
-	if (header->cth_typeoff & 3)
+	if (info->header->cth_parname)
+		info->child_base = 1ul << V::parent_shift;
+
+	info->id_to_types[0] = make_type<CtfTypeVaArg>(CtfTypeHead{}, 0, "va_arg",
+												   info.get());
+
+	auto visit = [&](uint32_t id, uint32_t offset, const CtfRecord<V> &sym)
 	{
-		std::cout << "cth_typeoff is not aligned porperly\n";
-		return (false);
-	}
+		info->type_offsets.push_back(offset);
+		CTFDIFF_PARSE_TYPE(probe_str(metadata.file_name()), id,
+						   sym.kind());
+
+		switch (sym.kind())
+		{
+		case CTF_K_STRUCT:
+		case CTF_K_UNION:
+		case CTF_K_ENUM:
+			if (sym.name() != 0)
+				info->tag_to_types.emplace(
+					static_cast<uint64_t>(sym.kind()) << 32 | sym.name(),
+					id);
+			/* FALLTHROUGH */
+		case CTF_K_TYPEDEF:
+			info->index_named_type(sym.kind(), id,
+								   info->get_str_from_ref(sym.name()));
+			break;
+		}
+	};
 
-	if (header->cth_typeoff >= metadata.ctfdata.size)
+	if (!ctf_check_types<V>(info->header, metadata.ctfdata.data,
+							info->child_base, last_id, error, visit))
 	{
-		std::cout << "file is truncated or cth_typeoff is corrupt\n";
+		std::cout << metadata.file_name() << " is corrupt: " << error
+				  << '\n';
 		return (false);
 	}
 
-	if (header->cth_stroff >= metadata.ctfdata.size)
+	return (true);
+}
+
+const CtfType &CtfData::decode_type(uint32_t id)
+{
+	return ((this->*decode_fn)(id));
+}
+
+/* build the type of one record found by do_parse_types */
+template <typename V>
+const CtfType &CtfData::decode_record(uint32_t id)
+{
+	const std::byte *iter = metadata.ctfdata.data + header->cth_typeoff +
+							type_offsets[id - child_base - 1];
+	CtfRecord<V> sym(iter);
+	CtfTypeHead head{sym.kind(), sym.size()};
+	std::string_view name = get_str_from_ref(sym.name());
+	ShrCtfType &type = id_to_types[id];
+
+	union
 	{
-		std::cout << "file is truncated or cth_stroff is corrupt\n";
-		return (false);
+		const std::byte *ptr;
+		const ctf_enum_t *ep;
+	} u;
+
+	u.ptr = iter + sym.increment();
+	++ctf_stats.kinds[sym.kind()];
+
+	switch (sym.kind())
+	{
+	case CTF_K_INTEGER:
+		type = make_type<CtfTypeInteger>(
+			*reinterpret_cast<const uint_t *>(u.ptr), head, id, name, this);
+		break;
+
+	case CTF_K_FLOAT:
+		type = make_type<CtfTypeFloat>(
+			*reinterpret_cast<const uint_t *>(u.ptr), head, id, name, this);
+		break;
+
+	case CTF_K_POINTER:
+		type = make_type<CtfTypePtr>(sym.type(), head, id, name, this);
+		break;
+
+	case CTF_K_ARRAY:
+		type = make_type<CtfTypeArray>(sym.array(u.ptr), head, id, name,
+										   this);
+		break;
+
+	case CTF_K_FUNCTION:
+	{
+		uint_t arg = 0;
+		int n = sym.vlen();
+		ArgList args;
+
+		for (int i = 0; i < n; ++i, u.ptr += V::id_width)
+		{
+			memcpy(&arg, u.ptr, V::id_width);
+			args.push_back(arg);
+		}
+
+		type = make_type<CtfTypeFunc>(sym.type(), std::move(args), head,
+										  id, name, this);
+		break;
 	}
 
-	if (header->cth_typeoff > header->cth_stroff)
+	case CTF_K_STRUCT:
+	case CTF_K_UNION:
 	{
-		std::cout << "file is corrupt -- cth_typeoff > cth_stroff\n";
-		return (false);
+		auto members = sym.members(u.ptr, [this](uint_t ref)
+								   { return (get_str_from_ref(ref)); });
+
+		if (sym.kind() == CTF_K_STRUCT)
+			type = make_type<CtfTypeStruct>(
+				sym.size(), std::move(members), head, id, name, this);
+		else
+			type = make_type<CtfTypeUnion>(
+				sym.size(), std::move(members), head, id, name, this);
+		break;
 	}
 
-	uint32_t version = header->cth_version;
-	id = 1;
-	if (header->cth_parname)
-		id += 1ul << (header->cth_version == CTF_VERSION_2 ? CTF_V2_PARENT_SHIFT : CTF_V3_PARENT_SHIFT);
+	case CTF_K_ENUM:
+	{
+		EnumList vec;
+		int n = sym.vlen(), i;
 
-	type_factory = info->get_type_factory();
+		for (i = 0; i < n; ++i, u.ep++)
+			vec.push_back(
+				{get_str_from_ref(u.ep->cte_name), u.ep->cte_value});
 
-	id_to_types[0] = std::make_shared<CtfTypeVaArg>(nullptr, 0, "va_arg",
-													info);
+		type = make_type<CtfTypeEnum>(std::move(vec), head, id, name, this);
+		break;
+	}
 
-	for (/* */; iter < end; ++id)
+	case CTF_K_FORWARD:
 	{
-		CtfTypeParser *sym = type_factory(iter);
-		vlen = 0;
+		/* old converters left the kind of a forward as 0 */
+		int tag = sym.type() != 0 ? sym.type() : CTF_K_STRUCT;
 
-		union
-		{
-			const std::byte *ptr;
-			struct ctf_array_v2 *ap2;
-			struct ctf_array_v3 *ap3;
-			const struct ctf_member_v2 *mp2;
-			const struct ctf_member_v3 *mp3;
-			const struct ctf_lmember_v2 *lmp2;
-			const struct ctf_lmember_v3 *lmp3;
-			const ctf_enum_t *ep;
-		} u;
-
-		increment = sym->increment();
-		u.ptr = iter + increment;
-
-		switch (sym->kind())
-		{
-		case CTF_K_INTEGER:
-		{
-			uint_t encoding = *(
-				reinterpret_cast<const uint_t *>(u.ptr));
-			vlen = sizeof(uint32_t);
-			id_to_types[id] =
-				std::make_shared<CtfTypeInteger>(encoding, sym, id,
-												 info->get_str_from_ref(sym->name()), info);
-			break;
-		}
+		type = make_type<CtfTypeForward>(tag, sym.name(), head, id, name,
+											 this);
+		break;
+	}
+	case CTF_K_TYPEDEF:
+		type = make_type<CtfTypeTypeDef>(sym.type(), head, id, name, this);
+		break;
+	case CTF_K_VOLATILE:
+		type = make_type<CtfTypeVolatile>(sym.type(), head, id, name,
+											  this);
+		break;
+	case CTF_K_CONST:
+		type = make_type<CtfTypeConst>(sym.type(), head, id, name, this);
+		break;
+	case CTF_K_RESTRICT:
+		type = make_type<CtfTypeRestrict>(sym.type(), head, id, name,
+											  this);
+		break;
+	case CTF_K_UNKNOWN:
+		type = make_type<CtfTypeUnknown>(head, id, this);
+		break;
+	}
 
-		case CTF_K_FLOAT:
-		{
-			uint_t encoding = *(
-				reinterpret_cast<const uint_t *>(u.ptr));
-			vlen = sizeof(uint32_t);
-			id_to_types[id] =
-				std::make_shared<CtfTypeFloat>(encoding, sym, id,
-											   info->get_str_from_ref(sym->name()), info);
-			break;
-		}
+	return (*type);
+}
 
-		case CTF_K_POINTER:
-		{
-			uint_t type = sym->type();
-			id_to_types[id] = std::make_shared<CtfTypePtr>(type,
-														   sym, id, info->get_str_from_ref(sym->name()), info);
-			break;
-		}
+void CtfData::decode_types()
+{
+	for (uint32_t i = 0; i < type_offsets.size(); ++i)
+		decode_type(child_base + 1 + i);
+}
 
-		case CTF_K_ARRAY:
-			id_to_types[id] = std::make_shared<CtfTypeArray>(u.ptr,
-															 sym, id, info->get_str_from_ref(sym->name()), info);
-			if (version == CTF_VERSION_2)
-				vlen = sizeof(struct ctf_array_v2);
-			else
-				vlen = sizeof(struct ctf_array_v3);
-			break;
+/*
+ * decode only the types reachable from the selected symbols, including
+ * the definitions of forwards. Types of the parent are its business.
+ */
+void CtfData::decode_closure()
+{
+	std::vector<uint32_t> work;
 
-		case CTF_K_FUNCTION:
-		{
-			uint_t ret = sym->type();
-			uint_t arg = 0;
-			int n = sym->vlen();
-			std::vector<uint_t> args;
+	for (const auto &var : static_variables)
+		work.push_back(var.type);
+	for (const auto &func : functions)
+		work.insert(work.end(), func.type.begin(), func.type.end());
 
-			for (int i = 0; i < n; ++i, u.ptr += ctf_id_width)
-			{
-				memcpy(&arg, u.ptr, ctf_id_width);
-				args.push_back(arg);
-			}
+	while (!work.empty())
+	{
+		uint32_t id = work.back();
+		work.pop_back();
 
-			id_to_types[id] = std::make_shared<CtfTypeFunc>(ret,
-															std::move(args), sym, id,
-															info->get_str_from_ref(sym->name()), info);
-			vlen = roundup2(ctf_id_width * n, 4);
-			break;
-		}
+		if (id <= child_base || id > child_base + type_offsets.size() ||
+			id_to_types.count(id) != 0)
+			continue;
 
-		case CTF_K_STRUCT:
-		{
-			auto [size, members] = sym->do_struct(u.ptr,
-												  std::bind(&CtfData::get_str_from_ref, info.get(),
-															std::placeholders::_1));
-			id_to_types[id] = std::make_shared<CtfTypeStruct>(
-				sym->size(), std::move(members), sym, id,
-				info->get_str_from_ref(sym->name()), info);
-			vlen = size;
-			break;
-		}
+		const CtfType &type = decode_type(id);
+		std::vector<uint32_t> kids = type.child_ids();
 
-		case CTF_K_UNION:
-		{
-			auto [size, members] = sym->do_struct(u.ptr,
-												  std::bind(&CtfData::get_str_from_ref, info.get(),
-															std::placeholders::_1));
-			id_to_types[id] = std::make_shared<CtfTypeUnion>(
-				sym->size(), std::move(members), sym, id,
-				info->get_str_from_ref(sym->name()), info);
-			vlen = size;
-			break;
-		}
+		work.insert(work.end(), kids.begin(), kids.end());
 
-		case CTF_K_ENUM:
+		if (type.kind() == CTF_K_FORWARD)
 		{
-			std::vector<std::pair<std::string_view, uint32_t>> vec;
-			int n = sym->vlen(), i;
-
-			for (i = 0; i < n; ++i, u.ep++)
-				vec.push_back(
-					{info->get_str_from_ref(u.ep->cte_name),
-					 u.ep->cte_value});
-
-			id_to_types[id] =
-				std::make_shared<CtfTypeEnum>(std::move(vec), sym,
-											  id, info->get_str_from_ref(sym->name()), info);
-			vlen = sizeof(ctf_enum_t) * n;
-			break;
-		}
+			const auto &fwd = dynamic_cast<const CtfTypeForward &>(type);
+			auto iter = tag_to_types.find(
+				static_cast<uint64_t>(fwd.tag_kind()) << 32 |
+				fwd.name_index());
 
-		case CTF_K_FORWARD:
-			id_to_types[id] = std::make_shared<CtfTypeForward>(sym,
-															   id, info->get_str_from_ref(sym->name()), info);
-			break;
-		case CTF_K_TYPEDEF:
-			id_to_types[id] =
-				std::make_shared<CtfTypeTypeDef>(sym->type(), sym,
-												 id, info->get_str_from_ref(sym->name()), info);
-			break;
-		case CTF_K_VOLATILE:
-			id_to_types[id] =
-				std::make_shared<CtfTypeVolatile>(sym->type(), sym,
-												  id, info->get_str_from_ref(sym->name()), info);
-			break;
-		case CTF_K_CONST:
-			id_to_types[id] =
-				std::make_shared<CtfTypeConst>(sym->type(), sym, id,
-											   info->get_str_from_ref(sym->name()), info);
-			break;
-		case CTF_K_RESTRICT:
-			id_to_types[id] =
-				std::make_shared<CtfTypeRestrict>(sym->type(), sym,
-												  id, info->get_str_from_ref(sym->name()), info);
-			break;
-		case CTF_K_UNKNOWN:
-			id_to_types[id] = std::make_shared<CtfTypeUnknown>(sym,
-															   id, info);
-			break;
-		default:
-			std::cout << "Unexpected kind: " << sym->kind() << '\n';
-			return (false);
+			if (iter != tag_to_types.end())
+				work.push_back(iter->second);
 		}
-
-		iter += increment + vlen;
 	}
-
-	return (true);
 }
 
+template <typename V>
 bool CtfData::do_parse_func(ShrCtfData info)
 {
 	auto &header = info->header;
 	auto &metadata = info->metadata;
 	auto &functions = info->functions;
-	auto ctf_id_width = info->ctf_id_width;
+	constexpr size_t ctf_id_width = V::id_width;
 
 	const std::byte *iter = metadata.ctfdata.data + header->cth_funcoff;
 	const std::byte *end = metadata.ctfdata.data + header->cth_typeoff;
@@ -474,16 +684,16 @@ bool CtfData::do_parse_func(ShrCtfData info)
 
 	int32_t id;
 	int symidx;
-	uint_t ctf_sym_info;
+	uint_t ctf_sym_info = 0;
 
 	for (symidx = -1, id = 0; iter < end; ++id)
 	{
 		memcpy(&ctf_sym_info, iter, ctf_id_width);
 		iter += ctf_id_width;
-		ushort_t kind = header->cth_version == CTF_VERSION_2 ? CTF_V2_INFO_KIND(ctf_sym_info) : CTF_V3_INFO_KIND(ctf_sym_info);
-		ushort_t n = header->cth_version == CTF_VERSION_2 ? CTF_V2_INFO_VLEN(ctf_sym_info) : CTF_V3_INFO_VLEN(ctf_sym_info);
+		ushort_t kind = V::kind(ctf_sym_info);
+		ushort_t n = V::vlen(ctf_sym_info);
 
-		uint_t i, arg;
+		uint_t i, arg = 0;
 
 		if (metadata.strdata.data != nullptr)
 			name = info->find_next_symbol_with_type(symidx,
@@ -491,20 +701,14 @@ bool CtfData::do_parse_func(ShrCtfData info)
 		else
 			name = "";
 
+		/* ctf_check_symbols left nothing but padding and functions */
 		if (kind == CTF_K_UNKNOWN && n == 0)
-			continue; /* padding, skip it */
-
-		if (kind != CTF_K_FUNCTION)
-			std::cout << "incorrect type for function: " << name
-					  << '\n';
-
-		if (iter + n * ctf_id_width > end)
-			std::cout << "function out of bound: " << name << '\n';
+			continue;
 
-		if (name != "")
+		if (name != "" && symbol_selected(name))
 		{
 			/* Return value */
-			std::vector<uint_t> args;
+			SymbolArgs args;
 			memcpy(&arg, iter, ctf_id_width);
 			iter += ctf_id_width;
 			args.push_back(arg);
@@ -520,29 +724,292 @@ bool CtfData::do_parse_func(ShrCtfData info)
 								 static_cast<uint32_t>(id)});
 		}
 		else
-			iter += n * ctf_id_width + 1;
+			iter += (n + 1) * ctf_id_width;
 	}
 
 	return (true);
 }
 
+void CtfData::index_named_type(int kind, uint32_t id,
+								std::string_view name)
+{
+	if (name == "" || name == "(anon)")
+		return;
+
+	/* the first definition wins if a name appears more than once */
+	if (name_to_types.emplace(CtfTypeName{kind, name}, id).second)
+		named_types.push_back({{kind, name}, id});
+}
+
+/* types whose layout must be known before the layout of type */
+static std::vector<uint32_t>
+layout_deps(const CtfType &type)
+{
+	std::vector<uint32_t> deps;
+
+	switch (type.kind())
+	{
+	case CTF_K_ARRAY:
+		deps.push_back(dynamic_cast<const CtfTypeArray &>(type).contents());
+		break;
+	case CTF_K_STRUCT:
+	case CTF_K_UNION:
+		for (const auto &m :
+			 dynamic_cast<const CtfTypeComplex &>(type).member_list())
+			deps.push_back(m.type_id);
+		break;
+	case CTF_K_TYPEDEF:
+	case CTF_K_VOLATILE:
+	case CTF_K_CONST:
+	case CTF_K_RESTRICT:
+		deps.push_back(dynamic_cast<const CtfTypeQualifier &>(type).ref());
+		break;
+	}
+
+	return (deps);
+}
+
+/*
+ * a forward of a child may be defined in the parent, whose string table
+ * differs, so the parent is searched by name
+ */
+const CtfType *
+CtfData::find_definition(int kind, uint32_t name_ref) const
+{
+	auto iter = tag_to_types.find(static_cast<uint64_t>(kind) << 32 |
+								  name_ref);
+
+	if (iter != tag_to_types.end())
+		return (id_to_types.at(iter->second).get());
+
+	if (parent == nullptr)
+		return (nullptr);
+
+	auto p_iter = parent->name_to_types.find(
+		CtfTypeName{kind, get_str_from_ref(name_ref)});
+
+	if (p_iter == parent->name_to_types.end())
+		return (nullptr);
+
+	return (parent->id_to_types.at(p_iter->second).get());
+}
+
+/* ids of a child below child_base belong to its parent */
+bool CtfData::in_parent(uint32_t id) const
+{
+	return (id != 0 && id < child_base);
+}
+
+const ShrCtfType *
+CtfData::find_type(uint32_t id) const
+{
+	if (in_parent(id))
+		return (parent != nullptr ? parent->find_type(id) : nullptr);
+
+	auto iter = id_to_types.find(id);
+
+	return (iter != id_to_types.end() ? &iter->second : nullptr);
+}
+
+std::pair<uint32_t, uint32_t>
+CtfData::id_range() const
+{
+	return {child_base + 1, child_base + type_offsets.size()};
+}
+
+/*
+ * fingerprints are computed for all types at the first request, those of
+ * an index are loaded with it
+ */
+uint64_t
+CtfData::fingerprint(uint32_t id) const
+{
+	if (in_parent(id) && parent != nullptr)
+		return (parent->fingerprint(id));
+
+	std::call_once(fingerprints_once,
+				   [this]()
+				   {
+					   if (fingerprints.empty())
+						   fingerprints = ctf_fingerprints(
+							   *this, fingerprints_exact, fingerprints_unique);
+				   });
+
+	auto iter = fingerprints.find(id);
+	if (iter != fingerprints.end())
+		return (iter->second);
+
+	/* unknown to this file, must not match anything */
+	return (ctf_unique_print(this, id));
+}
+
+/* whether equal fingerprints mean equal types, see ctf_fingerprints */
+bool CtfData::exact_fingerprints() const
+{
+	fingerprint(0);
+
+	return (fingerprints_exact &&
+			(parent == nullptr || parent->exact_fingerprints()));
+}
+
+/* whether some fingerprints are only valid in this run */
+bool CtfData::unique_fingerprints() const
+{
+	fingerprint(0);
+
+	return (fingerprints_unique ||
+			(parent != nullptr && parent->unique_fingerprints()));
+}
+
+/*
+ * take over the fingerprints of an earlier build of the same file whose
+ * type and string regions are identical, the ids name the same types
+ */
+bool CtfData::reuse_fingerprints(const CtfData &prev)
+{
+	bool reused = false;
+
+	if (!same_types(prev) || child_base != prev.child_base)
+		return (false);
+
+	prev.fingerprint(0);
+	std::call_once(fingerprints_once,
+				   [&]()
+				   {
+					   fingerprints = prev.fingerprints;
+					   fingerprints_exact = prev.fingerprints_exact;
+					   fingerprints_unique = prev.fingerprints_unique;
+					   reused = true;
+				   });
+
+	return (reused);
+}
+
+CtfLayout
+CtfData::layout_of(uint32_t id) const
+{
+	if (in_parent(id))
+		return (parent != nullptr ? parent->layout_of(id) : CtfLayout{0, 1});
+
+	auto iter = layouts.find(id);
+
+	return (iter != layouts.end() ? iter->second : CtfLayout{0, 1});
+}
+
+/*
+ * resolve the layout of a type after all of its dependencies, walking
+ * with an explicit stack so that long typedef chains can not overflow the
+ * call stack. Every layout is stored, so each type is resolved only once
+ * per file.
+ */
+void CtfData::resolve_layout(uint32_t root)
+{
+	std::vector<std::pair<uint32_t, bool>> stack = {{root, false}};
+	std::unordered_set<uint32_t> in_progress;
+
+	while (!stack.empty())
+	{
+		auto [id, expanded] = stack.back();
+		stack.pop_back();
+
+		/* already resolved by the parent */
+		if (in_parent(id))
+			continue;
+
+		auto iter = id_to_types.find(id);
+		if (iter == id_to_types.end())
+		{
+			layouts.emplace(id, CtfLayout{0, 1});
+			continue;
+		}
+
+		const CtfType &type = *iter->second;
+
+		if (!expanded)
+		{
+			/* a type in progress can only be reached by a cycle */
+			if (layouts.find(id) != layouts.end() ||
+				!in_progress.insert(id).second)
+				continue;
+
+			stack.push_back({id, true});
+			for (uint32_t dep : layout_deps(type))
+				if (!in_parent(dep) && layouts.find(dep) == layouts.end())
+					stack.push_back({dep, false});
+			continue;
+		}
+
+		CtfLayout res{0, 1};
+
+		switch (type.kind())
+		{
+		case CTF_K_INTEGER:
+		case CTF_K_FLOAT:
+		case CTF_K_ENUM:
+			res.size = type.type_size();
+			if (res.size != 0 && (res.size & (res.size - 1)) == 0)
+				res.align = res.size;
+			break;
+		case CTF_K_POINTER:
+			res.size = res.align = metadata.pointer_size;
+			break;
+		case CTF_K_ARRAY:
+		{
+			const CtfTypeArray &arr =
+				dynamic_cast<const CtfTypeArray &>(type);
+			CtfLayout elem = layout_of(arr.contents());
+
+			res.size = elem.size * arr.members();
+			res.align = elem.align;
+			break;
+		}
+		case CTF_K_STRUCT:
+		case CTF_K_UNION:
+			res.size = type.type_size();
+			for (uint32_t dep : layout_deps(type))
+				res.align = std::max(res.align, layout_of(dep).align);
+			break;
+		case CTF_K_TYPEDEF:
+		case CTF_K_VOLATILE:
+		case CTF_K_CONST:
+		case CTF_K_RESTRICT:
+			res = layout_of(layout_deps(type)[0]);
+			break;
+		}
+
+		layouts[id] = res;
+		in_progress.erase(id);
+	}
+}
+
+void CtfData::resolve_layouts()
+{
+	for (const auto &[id, type] : id_to_types)
+		resolve_layout(id);
+}
+
+/* layouts of a file parsed without -layout, e.g. one kept by the daemon */
+void CtfData::prepare_layouts()
+{
+	if (parent != nullptr)
+		parent->prepare_layouts();
+
+	if (layouts.empty())
+		resolve_layouts();
+}
+
 std::string_view
-CtfData::get_str_from_ref(uint_t ref)
+CtfData::get_str_from_ref(uint_t ref) const
 {
 	size_t offset = CTF_NAME_OFFSET(ref);
 
 	const char *s = reinterpret_cast<const char *>(
 		metadata.ctfdata.data + header->cth_stroff + offset);
 
+	/* offsets into the table were checked along with the types */
 	if (CTF_NAME_STID(ref) != CTF_STRTAB_0)
 		return ("<< ??? - name in external strtab >>");
 
-	if (offset >= header->cth_strlen)
-		return ("<< ??? - name exceeds strlab len >>");
-
-	if (header->cth_stroff + offset >= metadata.ctfdata.size)
-		return ("<< ??? - file truncated >>");
-
 	if (s[0] == '\n')
 		return ("(anon)");
 
@@ -552,13 +1019,14 @@ CtfData::get_str_from_ref(uint_t ref)
 #define L_DIFF 0
 #define R_DIFF 1
 
-template <typename Ret, typename T>
+template <typename Ret, typename T, typename List>
 std::pair<std::vector<Ret>, std::vector<Ret>>
-do_diff_generic(const std::vector<T> &lhs, const std::vector<T> &rhs,
+do_diff_generic(const List &lhs, const List &rhs,
 				const std::function<bool(const typename Ret::ty_type &,
 										 const typename Ret::ty_type &)> &compare,
 				const std::function<std::optional<typename Ret::ty_type>(
-					const typename T::ty_type &, int LR)> &id_to_syms)
+					const typename T::ty_type &, int LR)> &id_to_syms,
+				std::ostream &out)
 {
 	size_t l_idx = 0, r_idx = 0;
 	int name_diff;
@@ -573,11 +1041,12 @@ do_diff_generic(const std::vector<T> &lhs, const std::vector<T> &rhs,
 			auto syms = id_to_syms(lhs[l_idx].type, L_DIFF);
 			if (syms != std::nullopt)
 			{
-				std::cout << "< [" << lhs[l_idx].id << "] "
-						  << lhs[l_idx].name << '\n';
+				out << "< [" << lhs[l_idx].id << "] "
+					<< lhs[l_idx].name << '\n';
 				l_diff.push_back(
 					{lhs[l_idx].name, *syms, lhs[l_idx].id});
 			}
+			++ctf_stats.symbols_removed;
 			++l_idx;
 		}
 		else if (name_diff > 0)
@@ -585,11 +1054,12 @@ do_diff_generic(const std::vector<T> &lhs, const std::vector<T> &rhs,
 			auto syms = id_to_syms(rhs[r_idx].type, R_DIFF);
 			if (syms != std::nullopt)
 			{
-				std::cout << "> [" << rhs[r_idx].id << "] "
-						  << rhs[r_idx].name << '\n';
+				out << "> [" << rhs[r_idx].id << "] "
+					<< rhs[r_idx].name << '\n';
 				r_diff.push_back(
 					{rhs[r_idx].name, *syms, rhs[r_idx].id});
 			}
+			++ctf_stats.symbols_added;
 			++r_idx;
 		}
 		else
@@ -607,22 +1077,24 @@ do_diff_generic(const std::vector<T> &lhs, const std::vector<T> &rhs,
 				sym_diff = !compare(*l_syms, *r_syms);
 			}
 
+			++ctf_stats.symbols_matched;
 			if (sym_diff)
 			{
+				++ctf_stats.symbols_changed;
 				if (l_syms != std::nullopt)
 				{
-					std::cout << "< [" << lhs[l_idx].id
-							  << "] " << lhs[l_idx].name
-							  << '\n';
+					out << "< [" << lhs[l_idx].id
+						<< "] " << lhs[l_idx].name
+						<< '\n';
 
 					l_diff.push_back({lhs[l_idx].name,
 									  *l_syms, lhs[l_idx].id});
 				}
 				if (r_syms != std::nullopt)
 				{
-					std::cout << "> [" << rhs[r_idx].id
-							  << "] " << rhs[r_idx].name
-							  << '\n';
+					out << "> [" << rhs[r_idx].id
+						<< "] " << rhs[r_idx].name
+						<< '\n';
 					r_diff.push_back({rhs[r_idx].name,
 									  *r_syms, rhs[r_idx].id});
 				}
@@ -637,25 +1109,27 @@ do_diff_generic(const std::vector<T> &lhs, const std::vector<T> &rhs,
 		auto syms = id_to_syms(lhs[l_idx].type, L_DIFF);
 		if (syms != std::nullopt)
 		{
-			std::cout << "< [" << lhs[l_idx].id << "] "
-					  << lhs[l_idx].name << '\n';
+			out << "< [" << lhs[l_idx].id << "] "
+				<< lhs[l_idx].name << '\n';
 			l_diff.push_back(
 				{lhs[l_idx].name, *syms, lhs[l_idx].id});
 		}
+		++ctf_stats.symbols_removed;
 		++l_idx;
 	}
 
-	while (l_idx < lhs.size())
+	while (r_idx < rhs.size())
 	{
 		auto syms = id_to_syms(rhs[r_idx].type, R_DIFF);
 		if (syms != std::nullopt)
 		{
-			std::cout << "< [" << rhs[r_idx].id << "] "
-					  << rhs[r_idx].name << '\n';
+			out << "> [" << rhs[r_idx].id << "] "
+				<< rhs[r_idx].name << '\n';
 
 			r_diff.push_back(
 				{rhs[r_idx].name, *syms, rhs[r_idx].id});
 		}
+		++ctf_stats.symbols_added;
 		++r_idx;
 	}
 
@@ -665,33 +1139,24 @@ do_diff_generic(const std::vector<T> &lhs, const std::vector<T> &rhs,
 std::pair<std::vector<CtfData::CtfFuncTypeEntry>,
 		  std::vector<CtfData::CtfFuncTypeEntry>>
 CtfData::do_diff_func(const CtfData &rhs,
-					  std::unordered_map<uint64_t, bool> &cache) const
+					  CompareCache &cache,
+					  bool same_ids, std::ostream &out) const
 {
 	const auto &lhs = *this;
 
 	auto get_symbol =
-		[&](const std::vector<uint32_t> &ids,
+		[&](const SymbolArgs &ids,
 			int LR) -> std::optional<std::vector<ShrCtfType>>
 	{
 		std::vector<ShrCtfType> res;
-		const std::unordered_map<uint32_t, ShrCtfType> *converter;
-
-		switch (LR)
-		{
-		case L_DIFF:
-			converter = &(lhs.id_to_types);
-			break;
-		case R_DIFF:
-			converter = &(rhs.id_to_types);
-			break;
-		}
+		const CtfData &converter = LR == L_DIFF ? lhs : rhs;
 
 		for (const auto id : ids)
 		{
-			auto iter = converter->find(id);
-			if (iter == converter->end())
+			const ShrCtfType *type = converter.find_type(id);
+			if (type == nullptr)
 				return (std::nullopt);
-			res.push_back(iter->second);
+			res.push_back(*type);
 		}
 
 		return (std::make_optional(res));
@@ -707,6 +1172,8 @@ CtfData::do_diff_func(const CtfData &rhs,
 
 		for (; idx < lhs.size(); ++idx)
 		{
+			if (same_ids && lhs[idx]->type_id() == rhs[idx]->type_id())
+				continue;
 			if (!lhs[idx]->compare(*rhs[idx], cache))
 				return (false);
 		}
@@ -715,42 +1182,34 @@ CtfData::do_diff_func(const CtfData &rhs,
 	};
 
 	return do_diff_generic<CtfFuncTypeEntry, CtfFuncIdEntry>(
-		this->functions, rhs.functions, compare, get_symbol);
+		this->functions, rhs.functions, compare, get_symbol, out);
 }
 
 std::pair<std::vector<CtfData::CtfVarTypeEntry>,
 		  std::vector<CtfData::CtfVarTypeEntry>>
 CtfData::do_diff_var(const CtfData &rhs,
-					 std::unordered_map<uint64_t, bool> &cache) const
+					 CompareCache &cache,
+					 bool same_ids, std::ostream &out) const
 {
 	const auto &lhs = *this;
 
 	auto get_symbol = [&](const uint32_t &id,
 						  int LR) -> std::optional<ShrCtfType>
 	{
-		ShrCtfType res;
-		const std::unordered_map<uint32_t, ShrCtfType> *converter;
+		const CtfData &converter = LR == L_DIFF ? lhs : rhs;
+		const ShrCtfType *type = converter.find_type(id);
 
-		switch (LR)
-		{
-		case L_DIFF:
-			converter = &(lhs.id_to_types);
-			break;
-		case R_DIFF:
-			converter = &(rhs.id_to_types);
-			break;
-		}
-
-		auto iter = converter->find(id);
-		if (iter == converter->end())
+		if (type == nullptr)
 			return (std::nullopt);
-		res = iter->second;
 
-		return (std::make_optional(res));
+		return (std::make_optional(*type));
 	};
 
 	auto compare = [&](const ShrCtfType &lhs, const ShrCtfType &rhs)
 	{
+		if (same_ids && lhs->type_id() == rhs->type_id())
+			return (true);
+
 		if (!lhs->compare(*rhs, cache))
 			return (false);
 
@@ -758,22 +1217,373 @@ CtfData::do_diff_var(const CtfData &rhs,
 	};
 
 	return do_diff_generic<CtfVarTypeEntry, CtfVarIdEntry>(
-		this->static_variables, rhs.static_variables, compare, get_symbol);
+		this->static_variables, rhs.static_variables, compare, get_symbol,
+		out);
+}
+
+static const char *
+kind_prefix(int kind)
+{
+	switch (kind)
+	{
+	case CTF_K_STRUCT:
+		return ("struct ");
+	case CTF_K_UNION:
+		return ("union ");
+	case CTF_K_ENUM:
+		return ("enum ");
+	case CTF_K_TYPEDEF:
+		return ("typedef ");
+	default:
+		return ("");
+	}
+}
+
+/*
+ * a typedef is reported in detail only when it names an anonymous
+ * aggregate, named ones have their own entry in the report
+ */
+static void
+print_type_diff(const CtfTypeName &tn, const CtfType &lhs, const CtfType &rhs,
+				CompareCache &cache, std::ostream &out)
+{
+	const CtfType *l_type = &lhs, *r_type = &rhs;
+
+	if (tn.kind == CTF_K_TYPEDEF)
+	{
+		l_type = lhs.skip_ignored();
+		r_type = rhs.skip_ignored();
+
+		if (l_type->name() != "" && l_type->name() != "(anon)")
+			return;
+	}
+
+	l_type->print_diff(*r_type, cache, out);
+}
+
+/*
+ * match every named struct, union, enum and typedef by its tagged name and
+ * compare the pairs. Each side is walked once in parse order and matched
+ * through the hash index of the other side, so it is linear in the number
+ * of named types.
+ */
+std::pair<std::vector<CtfData::CtfVarTypeEntry>,
+		  std::vector<CtfData::CtfVarTypeEntry>>
+CtfData::do_diff_types(const CtfData &rhs,
+					   CompareCache &cache,
+					   bool same_ids, std::ostream &out) const
+{
+	const auto &lhs = *this;
+	std::vector<CtfVarTypeEntry> l_diff, r_diff;
+
+	for (const auto &[tn, id] : lhs.named_types)
+	{
+		const ShrCtfType &l_type = lhs.id_to_types.at(id);
+		auto r_iter = rhs.name_to_types.find(tn);
+
+		if (r_iter == rhs.name_to_types.end())
+		{
+			out << "< [" << id << "] " << kind_prefix(tn.kind)
+				<< tn.name << '\n';
+			l_diff.push_back({tn.name, l_type, id});
+			continue;
+		}
+
+		const ShrCtfType &r_type = rhs.id_to_types.at(r_iter->second);
+
+		if (same_ids && id == r_iter->second)
+			continue;
+
+		if (!l_type->compare(*r_type, cache))
+		{
+			out << "< [" << id << "] " << kind_prefix(tn.kind)
+				<< tn.name << '\n';
+			out << "> [" << r_iter->second << "] "
+				<< kind_prefix(tn.kind) << tn.name << '\n';
+			l_diff.push_back({tn.name, l_type, id});
+			r_diff.push_back({tn.name, r_type, r_iter->second});
+			print_type_diff(tn, *l_type, *r_type, cache, out);
+		}
+	}
+
+	for (const auto &[tn, id] : rhs.named_types)
+	{
+		if (lhs.name_to_types.find(tn) != lhs.name_to_types.end())
+			continue;
+
+		out << "> [" << id << "] " << kind_prefix(tn.kind)
+			<< tn.name << '\n';
+		r_diff.push_back({tn.name, rhs.id_to_types.at(id), id});
+	}
+
+	return (std::make_pair(l_diff, r_diff));
+}
+
+/*
+ * for every struct and union found by name on both sides, print the old
+ * and new size and alignment together with the members that moved or
+ * changed their size. Members are matched by name, members present on
+ * one side only are left to the detailed type diff.
+ */
+void CtfData::print_layout_diff(const CtfData &rhs, std::ostream &out) const
+{
+	for (const auto &[tn, id] : named_types)
+	{
+		if (tn.kind != CTF_K_STRUCT && tn.kind != CTF_K_UNION &&
+			tn.kind != CTF_K_TYPEDEF)
+			continue;
+
+		auto r_iter = rhs.name_to_types.find(tn);
+		if (r_iter == rhs.name_to_types.end())
+			continue;
+
+		const CtfType *l_type = id_to_types.at(id)->skip_ignored();
+		const CtfType *r_type =
+			rhs.id_to_types.at(r_iter->second)->skip_ignored();
+
+		/* named aggregates behind a typedef have their own entry */
+		if (tn.kind == CTF_K_TYPEDEF && l_type->name() != "" &&
+			l_type->name() != "(anon)")
+			continue;
+
+		if (l_type->kind() != r_type->kind() ||
+			(l_type->kind() != CTF_K_STRUCT &&
+			 l_type->kind() != CTF_K_UNION))
+			continue;
+
+		const auto &l_memb =
+			dynamic_cast<const CtfTypeComplex *>(l_type)->member_list();
+		const auto &r_memb =
+			dynamic_cast<const CtfTypeComplex *>(r_type)->member_list();
+		CtfLayout l_layout = layout_of(l_type->type_id());
+		CtfLayout r_layout = rhs.layout_of(r_type->type_id());
+		std::unordered_map<std::string_view, const MemberEntry *> r_names;
+		std::ostringstream members;
+
+		for (const auto &m : r_memb)
+			if (m.name != "")
+				r_names.emplace(m.name, &m);
+
+		for (const auto &l : l_memb)
+		{
+			auto iter = r_names.find(l.name);
+			if (l.name == "" || iter == r_names.end())
+				continue;
+
+			const MemberEntry &r = *iter->second;
+			uint64_t l_size = layout_of(l.type_id).size;
+			uint64_t r_size = rhs.layout_of(r.type_id).size;
+
+			if (l.offset != r.offset)
+				members << "\tmember " << l.name << " offset "
+					<< l.offset << " -> " << r.offset << '\n';
+			if (l_size != r_size)
+				members << "\tmember " << l.name << " size " << l_size
+					<< " -> " << r_size << '\n';
+		}
+
+		if (l_layout.size == r_layout.size &&
+			l_layout.align == r_layout.align && members.tellp() == 0)
+			continue;
+
+		out << kind_prefix(tn.kind) << tn.name << ": size "
+			<< l_layout.size << " -> " << r_layout.size << ", align "
+			<< l_layout.align << " -> " << r_layout.align << '\n'
+			<< members.str();
+	}
+}
+
+/* levels of types between the pairs compared ahead of a long chain */
+static constexpr uint32_t PREWARM_SPAN = 256;
+
+/*
+ * named structs and unions worth comparing ahead of the symbols, each after
+ * those it refers to unless they are in a cycle: the ones several types or
+ * symbols refer to, directly or through pointers, typedefs, qualifiers and
+ * arrays, and one every PREWARM_SPAN levels down a long chain of types, so
+ * that no compare has to recurse deeper than that before it reaches a
+ * settled pair.
+ */
+std::vector<uint32_t> CtfData::prewarm_types() const
+{
+	auto [first, last] = id_range();
+	std::vector<uint32_t> order, res;
+
+	if (last < first)
+		return (res);
+
+	size_t n = last - first + 1;
+	std::vector<const CtfType *> types(n);
+	std::vector<std::vector<uint32_t>> kids(n);
+	std::vector<uint32_t> refs(n);
+	std::vector<uint32_t> below(n); /* levels down to a checkpoint */
+	std::vector<uint8_t> checkpoint(n);
+	std::vector<uint8_t> state(n); /* 0 new, 1 entered, 2 done */
+	auto own = [&](uint32_t id)
+	{ return (id >= first && id <= last && types[id - first] != nullptr); };
+	auto named_aggregate = [&](uint32_t id)
+	{
+		const CtfType &type = *types[id - first];
+
+		return ((type.kind() == CTF_K_STRUCT || type.kind() == CTF_K_UNION) &&
+			type.name() != "" && type.name() != "(anon)");
+	};
+
+	for (const auto &[id, type] : id_to_types)
+	{
+		if (id >= first && id <= last)
+		{
+			types[id - first] = type.get();
+			kids[id - first] = type->child_ids();
+		}
+	}
+
+	std::vector<std::pair<uint32_t, bool>> stack;
+
+	/* post-order of a depth first walk, as in resolve_layout */
+	for (uint32_t root = first; root <= last; ++root)
+	{
+		stack.push_back({root, false});
+		while (!stack.empty())
+		{
+			auto [id, expanded] = stack.back();
+			stack.pop_back();
+
+			if (!own(id))
+				continue;
+			if (expanded)
+			{
+				uint32_t depth = 0;
+
+				/* the kids still entered close a cycle, they are above */
+				for (uint32_t kid : kids[id - first])
+					if (own(kid) && state[kid - first] == 2)
+						depth = std::max(depth, below[kid - first] + 1);
+				if (depth >= PREWARM_SPAN && named_aggregate(id))
+				{
+					checkpoint[id - first] = 1;
+					depth = 0;
+				}
+				below[id - first] = depth;
+				state[id - first] = 2;
+				order.push_back(id);
+				continue;
+			}
+			if (state[id - first] != 0)
+				continue;
+
+			state[id - first] = 1;
+			stack.push_back({id, true});
+			for (uint32_t kid : kids[id - first])
+				if (own(kid) && state[kid - first] == 0)
+					stack.push_back({kid, false});
+		}
+	}
+
+	for (uint32_t id : order)
+		for (uint32_t kid : kids[id - first])
+			if (own(kid))
+				++refs[kid - first];
+	for (const auto &f : functions)
+		for (uint32_t id : f.type)
+			if (own(id))
+				++refs[id - first];
+	for (const auto &v : static_variables)
+		if (own(v.type))
+			++refs[v.type - first];
+
+	/* what refers to a pointer or a typedef refers to its target */
+	for (auto iter = order.rbegin(); iter != order.rend(); ++iter)
+	{
+		const CtfType &type = *types[*iter - first];
+		uint32_t through = refs[*iter - first];
+		uint32_t target;
+
+		switch (type.kind())
+		{
+		case CTF_K_ARRAY:
+			target = dynamic_cast<const CtfTypeArray &>(type).contents();
+			break;
+		case CTF_K_POINTER:
+		case CTF_K_TYPEDEF:
+		case CTF_K_VOLATILE:
+		case CTF_K_CONST:
+		case CTF_K_RESTRICT:
+			target = dynamic_cast<const CtfTypeQualifier &>(type).ref();
+			break;
+		default:
+			continue;
+		}
+
+		if (own(target) && through > 1)
+			refs[target - first] += through - 1;
+	}
+
+	for (uint32_t id : order)
+		if (checkpoint[id - first] ||
+			(refs[id - first] > 1 && named_aggregate(id)))
+			res.push_back(id);
+
+	return (res);
+}
+
+/*
+ * compare first the types of prewarm_types found by name on both sides.
+ * The compares of the symbols then stop at these pairs in the cache
+ * instead of walking down through them from wherever the first symbol
+ * reaches them. The cache is only filled with settled results, so the
+ * order does not change them.
+ */
+void CtfData::prewarm_compare(const CtfData &rhs, CompareCache &cache) const
+{
+	CtfStats &stats = ctf_stats;
+	uint64_t nodes = stats.compare_nodes;
+
+	for (uint32_t id : prewarm_types())
+	{
+		const CtfType &type = *id_to_types.at(id);
+		auto r_iter = rhs.name_to_types.find({type.kind(), type.name()});
+
+		if (r_iter == rhs.name_to_types.end())
+			continue;
+
+		/* with -symbols only the types they reach are decoded */
+		const ShrCtfType *r_type = rhs.find_type(r_iter->second);
+		if (r_type == nullptr)
+			continue;
+
+		type.compare(**r_type, cache);
+		++stats.prewarm_pairs;
+	}
+
+	stats.prewarm_nodes += stats.compare_nodes - nodes;
 }
 
 /*
  * cache work as following:
- * id_pair = lhs.id << 31 | rhs.id
+ * id_pair = lhs.id << 32 | rhs.id
  * if id_pair found in map, means two types have compared
  * return the result directly, compare it vice versa
  */
 std::pair<CtfDiff, CtfDiff>
-CtfData::compare_and_get_diff(const CtfData &rhs) const
+CtfData::compare_and_get_diff(const CtfData &rhs, std::ostream &out) const
 {
-	std::unordered_map<uint64_t, bool> cache;
-	auto [l_diff_funcs, r_diff_funcs] = this->do_diff_func(rhs, cache);
-	auto [l_diff_syms, r_diff_syms] = this->do_diff_var(rhs, cache);
+	CompareCache cache;
+	bool same_ids = this->same_types(rhs);
+
+	if (!same_ids)
+		this->prewarm_compare(rhs, cache);
+
+	auto [l_diff_funcs, r_diff_funcs] =
+		this->do_diff_func(rhs, cache, same_ids, out);
+	auto [l_diff_syms, r_diff_syms] =
+		this->do_diff_var(rhs, cache, same_ids, out);
+	std::vector<CtfVarTypeEntry> l_diff_types, r_diff_types;
+
+	if ((flags & F_DIFF_TYPES) != 0)
+		std::tie(l_diff_types, r_diff_types) =
+			this->do_diff_types(rhs, cache, same_ids, out);
 
-	return std::make_pair(CtfDiff{l_diff_syms, l_diff_funcs},
-						  CtfDiff{r_diff_syms, r_diff_funcs});
+	return std::make_pair(CtfDiff{l_diff_syms, l_diff_funcs, l_diff_types},
+						  CtfDiff{r_diff_syms, r_diff_funcs, r_diff_types});
 }
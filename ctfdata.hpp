@@ -9,12 +9,18 @@
 #include "sys/ctf.h"
 
 #include "ctftype.hpp"
+#include "memacct.hpp"
 #include "metadata.hpp"
+#include <array>
 #include <cstdint>
 #include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
 #include <string_view>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 struct CtfDiff;
@@ -24,6 +30,42 @@ struct CtfType;
 using ShrCtfData = std::shared_ptr<CtfData>;
 using ShrCtfType = std::shared_ptr<CtfType>;
 
+/* regions of an inflated CTF section */
+enum CtfRegion {
+	CTF_REGION_OBJT,
+	CTF_REGION_FUNC,
+	CTF_REGION_TYPES,
+	CTF_REGION_STRINGS,
+	CTF_REGION_MAX,
+};
+
+/* size in bytes and alignment of a type as laid out in memory */
+struct CtfLayout {
+	uint64_t size;
+	uint32_t align;
+};
+
+/*
+ * name of a type tagged with its kind, so that struct foo, union foo and
+ * typedef foo do not collide in the name index
+ */
+struct CtfTypeName {
+	int kind;
+	std::string_view name;
+
+	bool operator==(const CtfTypeName &rhs) const
+	{
+		return (kind == rhs.kind && name == rhs.name);
+	}
+};
+
+template <> struct std::hash<CtfTypeName> {
+	size_t operator()(const CtfTypeName &tn) const
+	{
+		return (std::hash<std::string_view>()(tn.name) ^ tn.kind);
+	}
+};
+
 struct CtfData {
     public:
 	/* typedef */
@@ -34,49 +76,111 @@ struct CtfData {
 		uint32_t id;	       /* id of the variable */
 	};
 
+	using SymbolArgs = AcctVector<uint32_t, M_SYMBOLS>;
+	template <typename T> using SymbolList = AcctVector<T, M_SYMBOLS>;
 	using CtfFuncTypeEntry = CtfObjEntry<std::vector<ShrCtfType>>;
-	using CtfFuncIdEntry = CtfObjEntry<std::vector<uint32_t>>;
+	using CtfFuncIdEntry = CtfObjEntry<SymbolArgs>;
 	using CtfVarTypeEntry = CtfObjEntry<ShrCtfType>;
 	using CtfVarIdEntry = CtfObjEntry<uint32_t>;
 
     private:
 	/* members */
 	CtfMetaData metadata;
-	size_t ctf_id_width;
-	ctf_header_t *header;
-	std::unordered_map<uint32_t, ShrCtfType> id_to_types;
-	std::vector<CtfVarIdEntry> static_variables;
-	std::vector<CtfFuncIdEntry> functions;
+	ShrCtfData parent;	 /* holds the ids below child_base */
+	uint32_t child_base = 0; /* first id of a child, 0 without parent */
+	const ctf_header_t *header;
+	ctf_header_t swapped_header; /* header of a foreign section */
+	std::array<uint64_t, CTF_REGION_MAX> region_hash{};
+	AcctMap<uint32_t, ShrCtfType, M_INDEX> id_to_types;
+	SymbolList<CtfVarIdEntry> static_variables;
+	SymbolList<CtfFuncIdEntry> functions;
+	AcctVector<std::pair<CtfTypeName, uint32_t>, M_INDEX>
+	    named_types; /* named types in parse order */
+	AcctMap<CtfTypeName, uint32_t, M_INDEX> name_to_types;
+	AcctMap<uint32_t, CtfLayout, M_INDEX> layouts;
+	AcctMap<uint64_t, uint32_t, M_INDEX>
+	    tag_to_types; /* kind << 32 | name ref to the full definition */
+	AcctVector<uint32_t, M_INDEX>
+	    type_offsets; /* offset of each record in the type region */
+	mutable std::once_flag fingerprints_once;
+	mutable std::unordered_map<uint32_t, uint64_t> fingerprints;
+	mutable bool fingerprints_exact = false; /* see ctf_fingerprints */
+	mutable bool fingerprints_unique = false;
+	const CtfType &(CtfData::*decode_fn)(
+	    uint32_t) = nullptr; /* decode_record of our CTF version */
 
 	/* member function */
-	CtfTypeFactory get_type_factory();
 	bool zlib_decompress();
+	void hash_regions();
+	bool same_types(const CtfData &rhs) const;
 
 	std::string_view find_next_symbol_with_type(int &idx, uchar_t type);
-	std::string_view get_str_from_ref(uint_t ref);
+	std::string_view get_str_from_ref(uint_t ref) const;
+	bool in_parent(uint32_t id) const;
+	void load_parent();
 	bool ignore_symbol(GElf_Sym *sym, const char *name);
+	void index_named_type(int kind, uint32_t id, std::string_view name);
+	template <typename V> const CtfType &decode_record(uint32_t id);
+	const CtfType &decode_type(uint32_t id);
+	void decode_types();
+	void decode_closure();
+	void resolve_layout(uint32_t id);
+	void resolve_layouts();
+	bool load_index();
 
 	std::pair<std::vector<CtfFuncTypeEntry>, std::vector<CtfFuncTypeEntry>>
 	do_diff_func(const CtfData &rhs,
-	    std::unordered_map<uint64_t, bool> &cache) const;
+	    CompareCache &cache, bool same_ids,
+	    std::ostream &out) const;
 	std::pair<std::vector<CtfVarTypeEntry>, std::vector<CtfVarTypeEntry>>
 	do_diff_var(const CtfData &rhs,
-	    std::unordered_map<uint64_t, bool> &cache) const;
+	    CompareCache &cache, bool same_ids,
+	    std::ostream &out) const;
+	std::pair<std::vector<CtfVarTypeEntry>, std::vector<CtfVarTypeEntry>>
+	do_diff_types(const CtfData &rhs,
+	    CompareCache &cache, bool same_ids,
+	    std::ostream &out) const;
+	std::vector<uint32_t> prewarm_types() const;
+	void prewarm_compare(const CtfData &rhs, CompareCache &cache) const;
 	CtfData(CtfMetaData &&metadata);
 
 	/* static function */
-	static bool do_parse_types(ShrCtfData info);
-	static bool do_parse_data(ShrCtfData info);
-	static bool do_parse_func(ShrCtfData info);
+	template <typename V> static bool do_parse_types(ShrCtfData info);
+	template <typename V> static bool do_parse_data(ShrCtfData info);
+	template <typename V> static bool do_parse_func(ShrCtfData info);
+	template <typename V>
+	static ShrCtfData parse(ShrCtfData res, bool is_parent);
+	static ShrCtfData create(CtfMetaData &&metadata, bool is_parent);
 
     public:
-	std::pair<CtfDiff, CtfDiff> compare_and_get_diff(
-	    const CtfData &rhs) const;
+	std::pair<CtfDiff, CtfDiff> compare_and_get_diff(const CtfData &rhs,
+	    std::ostream &out) const;
+	void print_layout_diff(const CtfData &rhs, std::ostream &out) const;
+	CtfLayout layout_of(uint32_t id) const;
+	void prepare_layouts();
+	const CtfType *find_definition(int kind, uint32_t name_ref) const;
+	const ShrCtfType *find_type(uint32_t id) const;
+	std::pair<uint32_t, uint32_t> id_range() const; /* ids of our records */
+	uint64_t fingerprint(uint32_t id) const;
+	bool exact_fingerprints() const;
+	bool unique_fingerprints() const;
+	bool reuse_fingerprints(const CtfData &prev);
+	bool write_index(const std::string &path) const;
 
 	bool is_available();
-	inline const std::unordered_map<uint32_t, ShrCtfType> &id_mapper() const
+	inline const CtfMetaData &meta_data() const { return metadata; }
+	inline const AcctMap<CtfTypeName, uint32_t, M_INDEX> &
+	name_mapper() const
+	{
+		return name_to_types;
+	}
+	inline const SymbolList<CtfFuncIdEntry> &function_list() const
+	{
+		return functions;
+	}
+	inline const SymbolList<CtfVarIdEntry> &variable_list() const
 	{
-		return id_to_types;
+		return static_variables;
 	}
 
 	static std::shared_ptr<CtfData> create_ctf_info(CtfMetaData &&metadata);
@@ -85,4 +189,5 @@ struct CtfData {
 struct CtfDiff {
 	std::vector<CtfData::CtfVarTypeEntry> variables;
 	std::vector<CtfData::CtfFuncTypeEntry> functions;
+	std::vector<CtfData::CtfVarTypeEntry> types;
 };
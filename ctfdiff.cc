@@ -4,12 +4,41 @@
 #include "sys/elf_common.h"
 
 #include "ctfdata.hpp"
+#include "daemon.hpp"
+#include "driver.hpp"
+#include "memacct.hpp"
 #include "metadata.hpp"
+#include "stats.hpp"
 #include "utility.hpp"
+#include "watch.hpp"
+#include <algorithm>
 #include <iostream>
+#include <new>
+#include <optional>
+#include <string>
+#include <vector>
 
 static struct option longopts[] = {
-	{ "f-ignore-const", no_argument, NULL, 'c' }, { NULL, 0, NULL, 0 }
+	{ "f-ignore-const", no_argument, NULL, 'c' },
+	{ "types", no_argument, NULL, 't' },
+	{ "layout", no_argument, NULL, 'l' },
+	{ "baseline", required_argument, NULL, 'B' },
+	{ "jobs", required_argument, NULL, 'j' },
+	{ "tree", no_argument, NULL, 'T' },
+	{ "max-files", required_argument, NULL, 'F' },
+	{ "max-bytes", required_argument, NULL, 'M' },
+	{ "daemon", required_argument, NULL, 'D' },
+	{ "connect", required_argument, NULL, 'C' },
+	{ "cache-size", required_argument, NULL, 'E' },
+	{ "index", no_argument, NULL, 'I' },
+	{ "fingerprint", no_argument, NULL, 'P' },
+	{ "history", no_argument, NULL, 'H' },
+	{ "cluster", no_argument, NULL, 'G' },
+	{ "symbol", required_argument, NULL, 'S' },
+	{ "symbols-from", required_argument, NULL, 'L' },
+	{ "watch", no_argument, NULL, 'W' },
+	{ "stats", no_argument, NULL, 'X' },
+	{ "max-memory", required_argument, NULL, 'Y' }, { NULL, 0, NULL, 0 }
 };
 
 static void
@@ -17,20 +46,73 @@ print_usage()
 {
 	std::cout << "ctfdiff compare the SUNW_ctf section of two ELF files\n";
 	std::cout << "usage: ctfdiff <options> <file1> <file2>\n";
+	std::cout << "       ctfdiff <options> -B <baseline> <file> ...\n";
+	std::cout << "       ctfdiff <options> -tree <dir1> <dir2>\n";
+	std::cout << "       ctfdiff -daemon <socket> [-cache-size <n>]\n";
+	std::cout << "       ctfdiff <options> -connect <socket> <file1> "
+		     "<file2>\n";
+	std::cout << "       ctfdiff [-f-ignore-const] -index <file> ...\n";
+	std::cout << "       ctfdiff [-f-ignore-const] -fingerprint <file>\n";
+	std::cout << "       ctfdiff [-f-ignore-const] -history <file1> <file2> "
+		     "...\n";
+	std::cout << "       ctfdiff [-f-ignore-const] [-j <jobs>] -cluster "
+		     "<file> ...\n";
+	std::cout << "       ctfdiff <options> -watch <baseline> <file>\n";
 	std::cout << "options:\n";
-	std::cout << "-f-ignore-const: ignore const decorator";
+	std::cout << "-f-ignore-const: ignore const decorator\n";
+	std::cout << "-types: also compare all named structs, unions, enums "
+		     "and typedefs\n";
+	std::cout << "-layout: report size and member offset changes of "
+		     "structs and unions\n";
+	std::cout << "-stats: print phase times, counters and memory at the "
+		     "end of the run\n";
+	std::cout << "-symbol <glob>: only compare the matching data and "
+		     "function symbols\n";
+	std::cout << "-symbols-from <file>: only compare the symbols matching "
+		     "a glob of file\n";
+	std::cout << "-max-memory <size>: drop caches and fail cleanly beyond "
+		     "size bytes\n";
+	std::cout << "-B <baseline>: compare every file against baseline\n";
+	std::cout << "-j <jobs>: number of files compared at the same time\n";
+	std::cout << "-tree: compare all ELF files of two directory trees or "
+		     "tar archives\n";
+	std::cout << "-max-files <n>: files opened at the same time by -B "
+		     "and -tree\n";
+	std::cout << "-max-bytes <size>: CTF bytes held at the same time by "
+		     "-B and -tree\n";
+	std::cout << "-daemon <socket>: serve diff requests on a local socket\n";
+	std::cout << "-cache-size <n>: parsed files kept by the daemon\n";
+	std::cout << "-connect <socket>: ask the daemon for the diff\n";
+	std::cout << "-index: write the index sidecar of every file\n";
+	std::cout << "-fingerprint: print the fingerprints of the symbols, "
+		     "either file of a diff can be such a list\n";
+	std::cout << "-history: report the first build in which each symbol "
+		     "changed\n";
+	std::cout << "-watch: compare file again whenever it is rewritten\n";
+	std::cout << "-cluster: group the files by the ABI of each symbol\n";
 }
 
-static void
-do_compare_inplace(const CtfData &lhs, const CtfData &rhs)
+/* what the run did, after the output of any mode, for -stats */
+static int
+with_stats(int status)
 {
-	lhs.compare_and_get_diff(rhs);
+	if ((flags & F_STATS) != 0)
+		ctf_stats_total().print(std::cout);
+	return (status);
 }
 
-int
-main(int argc, char *argv[])
+static int
+ctfdiff_main(int argc, char *argv[])
 {
-	char *l_filename = nullptr, *r_filename = nullptr;
+	std::vector<std::string> filenames;
+	const char *baseline = nullptr;
+	bool tree = false;
+	DriverLimits limits;
+	std::optional<size_t> size;
+	const char *daemon_socket = nullptr, *connect_socket = nullptr;
+	size_t cache_size = 8;
+	bool index = false, fingerprint = false, history = false;
+	bool cluster = false, watch = false;
 
 	(void)elf_version(EV_CURRENT);
 	int c = 0;
@@ -39,56 +121,188 @@ main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 
 	for (opterr = 0; optind < argc; ++optind) {
-		while ((c = getopt_long_only(argc, argv, "c", longopts,
-			    NULL)) != (int)EOF) {
+		while ((c = getopt_long_only(argc, argv, "ctlB:j:TF:M:D:C:E:IPHGS:L:WXY:",
+			    longopts, NULL)) != (int)EOF) {
 			switch (c) {
 			case 'c':
 				flags |= F_IGNORE_CONST;
 				break;
+			case 't':
+				flags |= F_DIFF_TYPES;
+				break;
+			case 'l':
+				flags |= F_LAYOUT;
+				break;
+			case 'X':
+				flags |= F_STATS;
+				break;
+			case 'B':
+				baseline = optarg;
+				break;
+			case 'j':
+				limits.jobs = std::max(1, atoi(optarg));
+				break;
+			case 'T':
+				tree = true;
+				break;
+			case 'F':
+				limits.max_files = std::max(2, atoi(optarg));
+				break;
+			case 'M':
+				if (!(size = parse_size(optarg))) {
+					print_usage();
+					return (1);
+				}
+				limits.max_bytes = *size;
+				break;
+			case 'Y':
+				if (!(size = parse_size(optarg))) {
+					print_usage();
+					return (1);
+				}
+				max_memory = *size;
+				break;
+			case 'D':
+				daemon_socket = optarg;
+				break;
+			case 'C':
+				connect_socket = optarg;
+				break;
+			case 'E':
+				cache_size = std::max(2, atoi(optarg));
+				break;
+			case 'I':
+				index = true;
+				break;
+			case 'P':
+				fingerprint = true;
+				break;
+			case 'H':
+				history = true;
+				break;
+			case 'G':
+				cluster = true;
+				break;
+			case 'W':
+				watch = true;
+				break;
+			case 'S':
+				symbol_globs.push_back(optarg);
+				break;
+			case 'L':
+				if (!add_symbol_list(optarg))
+					return (1);
+				break;
 			}
 		}
 
-		if (optind < argc) {
-			if (l_filename != nullptr && r_filename != nullptr) {
-				print_usage();
-				return (0);
-			} else if (l_filename == nullptr) {
-				l_filename = argv[optind];
-			} else {
-				r_filename = argv[optind];
-			}
-		}
+		if (optind < argc)
+			filenames.push_back(argv[optind]);
 	}
 
-	if (l_filename == nullptr || r_filename == nullptr) {
+	if ((flags & F_IGNORE_CONST) != 0)
+		ignore_ids.push_back(&typeid(CtfTypeConst));
+
+	/* an index or a daemon must hold all symbols */
+	if (!symbol_globs.empty() &&
+	    (index || daemon_socket != nullptr || connect_socket != nullptr)) {
 		print_usage();
 		return (1);
 	}
 
-	CtfMetaData lhs(l_filename);
+	if (index) {
+		if (filenames.empty()) {
+			print_usage();
+			return (1);
+		}
+		return (with_stats(index_files(filenames, limits)));
+	}
 
-	if (!lhs.is_available()) {
-		std::cout << "Cannot parse file " << argv[1] << '\n';
+	/* the output of -fingerprint is read back, -daemon gets its flags */
+	if ((fingerprint || daemon_socket != nullptr) &&
+	    (flags & F_STATS) != 0) {
+		print_usage();
 		return (1);
 	}
 
-	CtfMetaData rhs(r_filename);
+	if (fingerprint) {
+		if (filenames.size() != 1) {
+			print_usage();
+			return (1);
+		}
+		return (print_fingerprints(filenames[0], std::cout));
+	}
 
-	if (!rhs.is_available()) {
-		std::cout << "Cannot parse file " << argv[1] << '\n';
-		return (1);
+	if (history) {
+		if (filenames.size() < 2) {
+			print_usage();
+			return (1);
+		}
+		return (with_stats(diff_history(filenames)));
 	}
 
-	auto l_info = CtfData::create_ctf_info(std::move(lhs));
-	if (l_info == nullptr)
-		return (1);
+	if (watch) {
+		if (filenames.size() != 2) {
+			print_usage();
+			return (1);
+		}
+		return (watch_diff(filenames[0], filenames[1]));
+	}
+
+	if (cluster) {
+		if (filenames.empty()) {
+			print_usage();
+			return (1);
+		}
+		return (with_stats(cluster_files(filenames, limits)));
+	}
+
+	if (daemon_socket != nullptr)
+		return (daemon_serve(daemon_socket, cache_size));
+
+	if (connect_socket != nullptr) {
+		if (filenames.size() != 2) {
+			print_usage();
+			return (1);
+		}
+		return (daemon_query(connect_socket, filenames[0],
+		    filenames[1]));
+	}
+
+	if (baseline != nullptr) {
+		if (filenames.empty()) {
+			print_usage();
+			return (1);
+		}
+		return (with_stats(diff_batch(baseline, filenames, limits)));
+	}
+
+	if (tree) {
+		if (filenames.size() != 2) {
+			print_usage();
+			return (1);
+		}
+		return (with_stats(diff_tree(filenames[0], filenames[1],
+		    limits)));
+	}
 
-	auto r_info = CtfData::create_ctf_info(std::move(rhs));
-	if (r_info == nullptr)
+	if (filenames.size() != 2) {
+		print_usage();
 		return (1);
+	}
 
-	if ((flags & F_IGNORE_CONST) != 0)
-		ignore_ids.push_back(&typeid(CtfTypeConst));
+	return (with_stats(diff_files(filenames[0], filenames[1])));
+}
 
-	do_compare_inplace(*l_info.get(), *r_info.get());
+/* running out of memory, or beyond -max-memory, shows what held it */
+int
+main(int argc, char *argv[])
+{
+	try {
+		return (ctfdiff_main(argc, argv));
+	} catch (const std::bad_alloc &) {
+		std::cout << "Cannot allocate memory\n";
+		mem_print(std::cout);
+		return (1);
+	}
 }
@@ -8,11 +8,15 @@
 
 #include "ctfdata.hpp"
 #include "ctftype.hpp"
+#include "myers.hpp"
+#include "probes.hpp"
+#include "stats.hpp"
 #include "utility.hpp"
 #include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <iostream>
+#include <ostream>
 #include <string_view>
 #include <unordered_map>
 #include <unordered_set>
@@ -20,252 +24,167 @@
 #include <vector>
 
 bool
-CtfTypeParser_V2::is_root() const
-{
-	return (CTF_V2_INFO_ISROOT(t.ctt_info));
-}
-
-int
-CtfTypeParser_V2::kind() const
+CtfType::compare(const CtfType &rhs,
+    CompareCache &cache) const
 {
-	return (CTF_V2_INFO_KIND(t.ctt_info));
-}
+	CompareVisited visited;
 
-ulong_t
-CtfTypeParser_V2::vlen() const
-{
-	return (CTF_V2_INFO_VLEN(t.ctt_info));
+	return do_compare_child(*this, rhs, this->id, rhs.id, visited, cache);
 }
 
-uint_t
-CtfTypeParser_V2::name() const
+const CtfType *
+CtfType::skip_ignored() const
 {
-	return (t.ctt_name);
-}
+	const CtfType *type = this;
 
-uint_t
-CtfTypeParser_V2::type() const
-{
-	return (t.ctt_type);
-}
+	auto ignored = [&](const auto &id) {
+		return (std::find(ignore_ids.begin(), ignore_ids.end(), id) !=
+		    ignore_ids.end());
+	};
 
-size_t
-CtfTypeParser_V2::increment() const
-{
-	if (t.ctt_size == CTF_V2_LSIZE_SENT) {
-		return (sizeof(ctf_type_v2));
-	} else {
-		return (sizeof(ctf_stype_v2));
-	}
-}
+	while (ignored(&typeid(*type))) {
+		const CtfTypeQualifier *t =
+		    dynamic_cast<const CtfTypeQualifier *>(type);
+		const ShrCtfType *next = type->get_owned()->find_type(t->ref());
 
-size_t
-CtfTypeParser_V2::size() const
-{
-	if (t.ctt_size == CTF_V2_LSIZE_SENT) {
-		return (sizeof(ctf_type_v2));
-	} else {
-		return (sizeof(ctf_stype_v2));
+		if (next == nullptr)
+			break;
+		type = next->get();
 	}
-}
 
-ArrayEntry
-CtfTypeParser_V2::do_array(const std::byte *bytes) const
-{
-	const ctf_array_v2 *arr = reinterpret_cast<const ctf_array_v2 *>(bytes);
-	return { arr->cta_contents, arr->cta_index, arr->cta_nelems };
+	return (type);
 }
 
-std::pair<size_t, std::vector<MemberEntry>>
-CtfTypeParser_V2::do_struct(const std::byte *bytes,
-    const std::function<std::string_view(uint)> &get_str_by_ref) const
+const CtfType *
+CtfType::resolve_forward() const
 {
-	std::vector<MemberEntry> res;
-	int n = vlen(), i;
-	size_t size;
-	if (this->size() >= CTF_V2_LSTRUCT_THRESH) {
-		const ctf_lmember_v2 *iter =
-		    reinterpret_cast<const ctf_lmember_v2 *>(bytes);
-		for (i = 0; i < n; ++i, ++iter)
-			res.push_back({ get_str_by_ref(iter->ctlm_name),
-			    iter->ctlm_type, CTF_LMEM_OFFSET(iter) });
-		size = n * sizeof(struct ctf_lmember_v2);
-	} else {
-		const ctf_member_v2 *iter =
-		    reinterpret_cast<const ctf_member_v2 *>(bytes);
-		for (i = 0; i < n; ++i, ++iter)
-			res.push_back({ get_str_by_ref(iter->ctm_name),
-			    iter->ctm_type, iter->ctm_offset });
-		size = n * sizeof(struct ctf_member_v2);
-	}
+	if (typeid(*this) != typeid(CtfTypeForward))
+		return (this);
 
-	return { size, res };
-}
+	const CtfType *def =
+	    dynamic_cast<const CtfTypeForward *>(this)->definition();
 
-CtfTypeParser *
-CtfTypeParser_V2::create_symbol(const std::byte *data)
-{
-	CtfTypeParser_V2 *res = new CtfTypeParser_V2;
-	memcpy(&res->t, data, sizeof(res->t));
-	return (res);
+	return (def != nullptr ? def : this);
 }
 
-bool
-CtfTypeParser_V3::is_root() const
+const CtfType *
+CtfTypeForward::definition() const
 {
-	return (CTF_V3_INFO_ISROOT(t.ctt_info));
+	return (get_owned()->find_definition(tag, name_ref));
 }
 
-int
-CtfTypeParser_V3::kind() const
+static int
+tag_kind(const CtfType &type)
 {
-	return (CTF_V3_INFO_KIND(t.ctt_info));
+	if (typeid(type) == typeid(CtfTypeForward))
+		return (dynamic_cast<const CtfTypeForward &>(type).tag_kind());
+	return (type.kind());
 }
 
-ulong_t
-CtfTypeParser_V3::vlen() const
-{
-	return (CTF_V3_INFO_VLEN(t.ctt_info));
-}
-
-uint_t
-CtfTypeParser_V3::name() const
-{
-	return (t.ctt_name);
-}
-
-uint_t
-CtfTypeParser_V3::type() const
-{
-	return (t.ctt_type);
-}
-
-size_t
-CtfTypeParser_V3::increment() const
-{
-	if (t.ctt_size == CTF_V3_LSIZE_SENT) {
-		return (sizeof(ctf_type_v3));
-	} else {
-		return (sizeof(ctf_stype_v3));
-	}
-}
-
-size_t
-CtfTypeParser_V3::size() const
-{
-	if (t.ctt_size == CTF_V3_LSIZE_SENT) {
-		return (sizeof(ctf_type_v3));
-	} else {
-		return (sizeof(ctf_stype_v3));
-	}
-}
-
-ArrayEntry
-CtfTypeParser_V3::do_array(const std::byte *bytes) const
-{
-	const ctf_array_v3 *arr = reinterpret_cast<const ctf_array_v3 *>(bytes);
-	return { arr->cta_contents, arr->cta_index, arr->cta_nelems };
-}
-
-std::pair<size_t, std::vector<MemberEntry>>
-CtfTypeParser_V3::do_struct(const std::byte *bytes,
-    const std::function<std::string_view(uint)> &get_str_by_ref) const
+bool
+CtfType::do_compare(const CtfType &_lhs, const CtfType &_rhs,
+    CompareVisited &visited,
+    CompareCache &cache)
 {
-	std::vector<MemberEntry> res;
-	int n = vlen(), i;
-	size_t size;
-	if (this->size() >= CTF_V3_LSTRUCT_THRESH) {
-		const ctf_lmember_v3 *iter =
-		    reinterpret_cast<const ctf_lmember_v3 *>(bytes);
-		for (i = 0; i < n; ++i, ++iter)
-			res.push_back({ get_str_by_ref(iter->ctlm_name),
-			    iter->ctlm_type, CTF_LMEM_OFFSET(iter) });
-
-		size = n * sizeof(ctf_lmember_v3);
-	} else {
-		const ctf_member_v3 *iter =
-		    reinterpret_cast<const ctf_member_v3 *>(bytes);
-		for (i = 0; i < n; ++i, ++iter)
-			res.push_back({ get_str_by_ref(iter->ctm_name),
-			    iter->ctm_type, iter->ctm_offset });
-
-		size = n * sizeof(ctf_member_v3);
-	}
+	/* we don't compare the type in ignore list */
+	const CtfType *lhs = _lhs.skip_ignored()->resolve_forward();
+	const CtfType *rhs = _rhs.skip_ignored()->resolve_forward();
+	bool res;
 
-	return { size, res };
-}
+	++ctf_stats.compare_nodes;
+	CTFDIFF_COMPARE_ENTRY(lhs->id, rhs->id);
+	res = do_compare_resolved(*lhs, *rhs, visited, cache);
+	CTFDIFF_COMPARE_RETURN(lhs->id, rhs->id, res);
 
-CtfTypeParser *
-CtfTypeParser_V3::create_symbol(const std::byte *data)
-{
-	CtfTypeParser_V3 *res = new CtfTypeParser_V3;
-	memcpy(&res->t, data, sizeof(res->t));
 	return (res);
 }
 
+/* do_compare once typedefs to ignore and forwards are resolved */
 bool
-CtfType::compare(const CtfType &rhs,
-    std::unordered_map<uint64_t, bool> &cache) const
-{
-	std::unordered_set<uint64_t> visited;
-
-	return do_compare_child(*this, rhs, this->id, rhs.id, visited, cache);
-}
-
-bool
-CtfType::do_compare(const CtfType &_lhs, const CtfType &_rhs,
-    std::unordered_set<uint64_t> &visited,
-    std::unordered_map<uint64_t, bool> &cache)
-{
-	const CtfType *lhs = &_lhs;
-	const CtfType *rhs = &_rhs;
-
-	auto ignored = [&](const auto &id) {
-		return (std::find(ignore_ids.begin(), ignore_ids.end(), id) !=
-		    ignore_ids.end());
-	};
-
-	/* we don't compare the type in ignore list */
-	while (ignored(&typeid(*lhs))) {
-		const CtfTypeQualifier *t =
-		    dynamic_cast<const CtfTypeQualifier *>(lhs);
-		lhs =
-		    lhs->get_owned()->id_mapper().find(t->ref())->second.get();
-	}
-
-	while (ignored(&typeid(*rhs))) {
-		const CtfTypeQualifier *t =
-		    dynamic_cast<const CtfTypeQualifier *>(rhs);
-		rhs =
-		    rhs->get_owned()->id_mapper().find(t->ref())->second.get();
-	}
+CtfType::do_compare_resolved(const CtfType &lhs, const CtfType &rhs,
+    CompareVisited &visited,
+    CompareCache &cache)
+{
+	/*
+	 * a forward without definition in its own file is opaque, it can only
+	 * be matched against a type with the same kind and name
+	 */
+	if (typeid(lhs) == typeid(CtfTypeForward) ||
+	    typeid(rhs) == typeid(CtfTypeForward))
+		return (tag_kind(lhs) == tag_kind(rhs) &&
+		    lhs.name() == rhs.name());
 
 	/* it guarentee all type should be same, so we can cast to specified
 	 * cast in each do_compare_impl */
-	if (typeid(*lhs) != typeid(*rhs))
+	if (typeid(lhs) != typeid(rhs))
 		return (false);
 
 	/* A type can be mutual refernce so that it will create a circle in the
 	 * graph */
 
-	uint64_t visited_pair = lhs->id << 31 | rhs->id;
+	uint64_t visited_pair = static_cast<uint64_t>(lhs.id) << 32 | rhs.id;
 
-	bool is_visited = visited.find(visited_pair) != visited.end();
+	auto on_path = visited.path.find(visited_pair);
+	if (on_path != visited.path.end()) {
+		visited.low = std::min(visited.low, on_path->second);
+		return (true);
+	}
 
-	if (is_visited)
+	auto assumed = visited.assumed.find(visited_pair);
+	if (assumed != visited.assumed.end()) {
+		visited.low = std::min(visited.low, assumed->second);
 		return (true);
+	}
 
-	if (cache.find(visited_pair) != cache.end())
-		return (cache[visited_pair]);
+	auto cached = cache.find(visited_pair);
+
+	if (cached != cache.end()) {
+		++ctf_stats.cache_hits;
+		CTFDIFF_CACHE_HIT(lhs.id, rhs.id, cached->second);
+		return (cached->second);
+	}
+	++ctf_stats.cache_misses;
+	CTFDIFF_CACHE_MISS(lhs.id, rhs.id);
+	if (++ctf_stats.depth > ctf_stats.max_depth)
+		ctf_stats.max_depth = ctf_stats.depth;
 
-	visited.insert(visited_pair);
-	bool comp_res = (lhs->do_compare_impl(*rhs,
+	uint32_t frame = visited.frames++, outer_low = visited.low;
+	size_t mark = visited.pending.size();
+
+	visited.low = UINT32_MAX;
+	visited.path.emplace(visited_pair, frame);
+	bool comp_res = (lhs.do_compare_impl(rhs,
 	    std::bind(CtfType::do_compare_child, std::placeholders::_1,
 		std::placeholders::_2, std::placeholders::_3,
 		std::placeholders::_4, std::ref(visited), std::ref(cache))));
+	visited.path.erase(visited_pair);
+	--ctf_stats.depth;
+
+	if (comp_res && visited.low < frame) {
+		visited.assumed.emplace(visited_pair, visited.low);
+		visited.pending.push_back(visited_pair);
+		visited.low = std::min(outer_low, visited.low);
+		return (true);
+	}
 
+	/*
+	 * settled, and so is every pair assumed below it. Each of them leads
+	 * back to this frame or one above, which all differ once this one
+	 * does, so they share its result either way.
+	 */
+	for (size_t i = mark; i < visited.pending.size(); ++i) {
+		cache[visited.pending[i]] = comp_res;
+		visited.assumed.erase(visited.pending[i]);
+	}
+	visited.pending.resize(mark);
 	cache[visited_pair] = comp_res;
-	visited.erase(visited_pair);
+	visited.low = outer_low;
+
+	/* beyond -max-memory the cache goes first, it only saves time */
+	if (mem_over_limit()) {
+		CompareCache().swap(cache);
+		++ctf_stats.cache_drops;
+	}
 
 	return (comp_res);
 }
@@ -273,26 +192,60 @@ CtfType::do_compare(const CtfType &_lhs, const CtfType &_rhs,
 bool
 CtfType::do_compare_child(const CtfType &lhs, const CtfType &rhs,
     uint32_t l_child_id, uint32_t r_child_id,
-    std::unordered_set<uint64_t> &visited,
-    std::unordered_map<uint64_t, bool> &cache)
+    CompareVisited &visited,
+    CompareCache &cache)
 {
-	auto &l_id_map = lhs.get_owned()->id_mapper();
-	auto &r_id_map = rhs.get_owned()->id_mapper();
-	auto l_child_iter = l_id_map.find(l_child_id);
-	auto r_child_iter = r_id_map.find(r_child_id);
+	const ShrCtfType *l_child = lhs.get_owned()->find_type(l_child_id);
+	const ShrCtfType *r_child = rhs.get_owned()->find_type(r_child_id);
 
 	/* In CTF, va_args record the ... as type 0, which is not contained in
 	 * the id_table */
-	if (l_child_iter == l_id_map.end() || r_child_iter == r_id_map.end())
+	if (l_child == nullptr || r_child == nullptr)
 		return (false);
 
-	return do_compare(*(l_child_iter->second), *(r_child_iter->second),
-	    visited, cache);
+	return do_compare(**l_child, **r_child, visited, cache);
+}
+
+std::vector<uint32_t>
+CtfType::child_ids() const
+{
+	std::vector<uint32_t> ids;
+
+	switch (kind()) {
+	case CTF_K_ARRAY: {
+		const auto &arr = dynamic_cast<const CtfTypeArray &>(*this);
+		ids = { arr.index(), arr.contents() };
+		break;
+	}
+	case CTF_K_FUNCTION: {
+		const auto &func = dynamic_cast<const CtfTypeFunc &>(*this);
+		ids.push_back(func.ret());
+		ids.insert(ids.end(), func.args().begin(), func.args().end());
+		break;
+	}
+	case CTF_K_STRUCT:
+	case CTF_K_UNION:
+		for (const auto &m :
+		    dynamic_cast<const CtfTypeComplex &>(*this).member_list())
+			ids.push_back(m.type_id);
+		break;
+	case CTF_K_POINTER:
+	case CTF_K_TYPEDEF:
+	case CTF_K_VOLATILE:
+	case CTF_K_CONST:
+	case CTF_K_RESTRICT:
+		ids.push_back(dynamic_cast<const CtfTypeQualifier &>(*this).ref());
+		break;
+	}
+
+	return (ids);
 }
 
-CtfType::~CtfType()
+void
+CtfType::print_diff(const CtfType &rhs __unused,
+    CompareCache &cache __unused,
+    std::ostream &out __unused) const
 {
-	delete this->parser;
 }
 
 uint32_t
@@ -403,7 +356,9 @@ bool
 CtfTypeForward::do_compare_impl(const CtfType &rhs,
     const CompareFunc &comp __unused) const
 {
-	return (this->name() == rhs.name());
+	const CtfTypeForward *d = dynamic_cast<const CtfTypeForward *>(&rhs);
+
+	return (this->tag == d->tag && this->name() == rhs.name());
 }
 
 bool
@@ -474,3 +429,179 @@ CtfTypeUnion::do_compare_impl(const CtfType &rhs, const CompareFunc &comp) const
 
 	return (true);
 }
+
+/*
+ * Members are matched by name with Myers' diff. A member deleted on one
+ * side and inserted on the other is reported as moved, a kept member is
+ * checked for a new offset or type.
+ */
+void
+CtfTypeComplex::print_diff(const CtfType &rhs,
+    CompareCache &cache, std::ostream &out) const
+{
+	if (typeid(*this) != typeid(rhs))
+		return;
+
+	const CtfTypeComplex *d = dynamic_cast<const CtfTypeComplex *>(&rhs);
+	const auto &l_memb = this->args, &r_memb = d->args;
+	std::vector<uint32_t> l_names, r_names;
+	std::unordered_map<uint32_t, size_t> deleted, inserted;
+	StringInterner interner;
+
+	for (const auto &m : l_memb)
+		l_names.push_back(interner.intern(m.name));
+	for (const auto &m : r_memb)
+		r_names.push_back(interner.intern(m.name));
+
+	auto edits = myers_diff(l_names, r_names);
+	std::vector<bool> shift_after(edits.size() + 1, false);
+
+	for (size_t i = edits.size(); i > 0; --i) {
+		const MyersEdit &e = edits[i - 1];
+
+		shift_after[i - 1] = shift_after[i] ||
+		    (e.op == M_KEEP &&
+			l_memb[e.l_idx].offset != r_memb[e.r_idx].offset);
+		/* anonymous members can not be paired by name */
+		if (e.op == M_DELETE && l_memb[e.l_idx].name != "")
+			deleted.emplace(l_names[e.l_idx], e.l_idx);
+		if (e.op == M_INSERT && r_memb[e.r_idx].name != "")
+			inserted.emplace(r_names[e.r_idx], e.r_idx);
+	}
+
+	auto retyped = [&](const MemberEntry &l, const MemberEntry &r) {
+		const ShrCtfType *l_type = get_owned()->find_type(l.type_id);
+		const ShrCtfType *r_type = d->get_owned()->find_type(r.type_id);
+
+		if (l_type == nullptr || r_type == nullptr)
+			return (true);
+		return (!(*l_type)->compare(**r_type, cache));
+	};
+
+	if (this->size != d->size)
+		out << "\tsize " << this->size << " -> " << d->size << '\n';
+
+	for (size_t i = 0; i < edits.size(); ++i) {
+		const MyersEdit &e = edits[i];
+		const char *shifted = shift_after[i + 1] ?
+		    ", subsequent offsets shifted" :
+		    "";
+
+		switch (e.op) {
+		case M_KEEP: {
+			const MemberEntry &l = l_memb[e.l_idx];
+			const MemberEntry &r = r_memb[e.r_idx];
+
+			if (l.offset != r.offset)
+				out << "\tmember " << l.name << " offset "
+				    << l.offset << " -> " << r.offset << '\n';
+			if (retyped(l, r))
+				out << "\tmember " << l.name
+				    << " type changed\n";
+			break;
+		}
+		case M_INSERT: {
+			const MemberEntry &r = r_memb[e.r_idx];
+			auto iter = deleted.find(r_names[e.r_idx]);
+
+			if (iter == deleted.end()) {
+				out << "\tmember " << r.name
+				    << " added at offset " << r.offset
+				    << shifted << '\n';
+				break;
+			}
+
+			const MemberEntry &l = l_memb[iter->second];
+			out << "\tmember " << r.name << " moved from index "
+			    << iter->second << " (offset " << l.offset
+			    << ") to index " << e.r_idx << " (offset "
+			    << r.offset << ")\n";
+			if (retyped(l, r))
+				out << "\tmember " << r.name
+				    << " type changed\n";
+			break;
+		}
+		case M_DELETE: {
+			const MemberEntry &l = l_memb[e.l_idx];
+
+			if (inserted.find(l_names[e.l_idx]) != inserted.end())
+				break; /* reported as moved */
+			out << "\tmember " << l.name << " removed from offset "
+			    << l.offset << shifted << '\n';
+			break;
+		}
+		}
+	}
+}
+
+void
+CtfTypeEnum::print_diff(const CtfType &rhs,
+    CompareCache &cache __unused,
+    std::ostream &out) const
+{
+	if (typeid(*this) != typeid(rhs))
+		return;
+
+	const CtfTypeEnum *d = dynamic_cast<const CtfTypeEnum *>(&rhs);
+	const auto &l_memb = this->members, &r_memb = d->members;
+	std::vector<uint32_t> l_names, r_names;
+	std::unordered_map<uint32_t, size_t> deleted, inserted;
+	StringInterner interner;
+
+	for (const auto &m : l_memb)
+		l_names.push_back(interner.intern(m.first));
+	for (const auto &m : r_memb)
+		r_names.push_back(interner.intern(m.first));
+
+	auto edits = myers_diff(l_names, r_names);
+
+	for (const auto &e : edits) {
+		if (e.op == M_DELETE)
+			deleted.emplace(l_names[e.l_idx], e.l_idx);
+		if (e.op == M_INSERT)
+			inserted.emplace(r_names[e.r_idx], e.r_idx);
+	}
+
+	auto renumbered = [&](size_t l_idx, size_t r_idx) {
+		int32_t l_val = l_memb[l_idx].second;
+		int32_t r_val = r_memb[r_idx].second;
+
+		if (l_val != r_val)
+			out << "\tenumerator " << l_memb[l_idx].first
+			    << " renumbered " << l_val << " -> " << r_val
+			    << '\n';
+	};
+
+	for (const auto &e : edits) {
+		switch (e.op) {
+		case M_KEEP:
+			renumbered(e.l_idx, e.r_idx);
+			break;
+		case M_INSERT: {
+			auto iter = deleted.find(r_names[e.r_idx]);
+
+			if (iter == deleted.end()) {
+				out << "\tenumerator " << r_memb[e.r_idx].first
+				    << " = "
+				    << static_cast<int32_t>(
+					   r_memb[e.r_idx].second)
+				    << " added\n";
+				break;
+			}
+
+			out << "\tenumerator " << r_memb[e.r_idx].first
+			    << " moved from index " << iter->second
+			    << " to index " << e.r_idx << '\n';
+			renumbered(iter->second, e.r_idx);
+			break;
+		}
+		case M_DELETE:
+			if (inserted.find(l_names[e.l_idx]) != inserted.end())
+				break; /* reported as moved */
+			out << "\tenumerator " << l_memb[e.l_idx].first << " = "
+			    << static_cast<int32_t>(l_memb[e.l_idx].second)
+			    << " removed\n";
+			break;
+		}
+	}
+}
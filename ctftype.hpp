@@ -1,14 +1,19 @@
 #pragma once
 
 #include <sys/cdefs.h>
+#include <sys/param.h>
+
+#include <string.h>
 
 #include "ctf_headers.h"
 #include "sys/ctf.h"
 
+#include "memacct.hpp"
 #include <cstddef>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <ostream>
 #include <string_view>
 #include <unordered_map>
 #include <unordered_set>
@@ -30,73 +35,180 @@ struct MemberEntry {
 	uint64_t offset;       /* offset in the member */
 };
 
-struct CtfTypeParser {
-	/* virtual function */
-	virtual ~CtfTypeParser() = default;
-	virtual bool is_root() const = 0;
-	virtual int kind() const = 0;
-	virtual ulong_t vlen() const = 0;
-	virtual uint_t name() const = 0;
-	virtual uint_t type() const = 0;
-	virtual size_t increment() const = 0;
-	virtual size_t size() const = 0;
-	virtual ArrayEntry do_array(const std::byte *bytes) const = 0;
-	virtual std::pair<size_t, std::vector<MemberEntry>>
-	do_struct(const std::byte *,
-	    const std::function<std::string_view(uint)> &) const = 0;
-};
+using MemberList = AcctVector<MemberEntry, M_MEMBERS>;
+using ArgList = AcctVector<uint32_t, M_MEMBERS>;
+using EnumList = AcctVector<std::pair<std::string_view, uint32_t>, M_MEMBERS>;
 
-struct CtfTypeParser_V2 : CtfTypeParser {
-    private:
-	struct ctf_type_v2 t;
+/* results of compared type pairs, lhs id << 32 | rhs id */
+using CompareCache = AcctMap<uint64_t, bool, M_CACHE>;
 
-    public:
-	/* virtual function */
-	virtual bool is_root() const override;
-	virtual int kind() const override;
-	virtual ulong_t vlen() const override;
-	virtual uint_t name() const override;
-	virtual uint_t type() const override;
-	virtual size_t increment() const override;
-	virtual size_t size() const override;
-	virtual ArrayEntry do_array(const std::byte *bytes) const override;
-	virtual std::pair<size_t, std::vector<MemberEntry>>
-	do_struct(const std::byte *,
-	    const std::function<std::string_view(uint)> &) const override;
+/*
+ * the state of one compare. A pair on the path is taken as equal when it
+ * is reached again through a cycle, so a pair found equal below it only
+ * holds if that pair turns out equal too. Such a pair is kept in assumed
+ * with the lowest frame it relied on, and moved to the cache once that
+ * frame is settled, as in Tarjan's algorithm.
+ */
+struct CompareVisited {
+	AcctMap<uint64_t, uint32_t, M_CACHE> path; /* pair to its frame */
+	AcctMap<uint64_t, uint32_t, M_CACHE> assumed;
+	AcctVector<uint64_t, M_CACHE> pending; /* keys of assumed, in order */
+	uint32_t frames = 0; /* frames entered, numbers the next one */
+	uint32_t low = UINT32_MAX; /* lowest frame relied on below a frame */
+};
 
-	/* static function */
-	static CtfTypeParser *create_symbol(const std::byte *data);
+/*
+ * the record layout of one CTF version. The parse loops are templates on
+ * it, so each version gets its own inlined instantiation.
+ */
+struct CtfV2 {
+	using type_t = struct ctf_type_v2;
+	using stype_t = struct ctf_stype_v2;
+	using array_t = struct ctf_array_v2;
+	using member_t = struct ctf_member_v2;
+	using lmember_t = struct ctf_lmember_v2;
+
+	static constexpr size_t id_width = 2;
+	static constexpr uint_t lsize_sent = CTF_V2_LSIZE_SENT;
+	static constexpr size_t lstruct_thresh = CTF_V2_LSTRUCT_THRESH;
+	static constexpr int parent_shift = CTF_V2_PARENT_SHIFT;
+	static constexpr uint_t max_type = CTF_V2_MAX_TYPE;
+	static constexpr uint_t max_ptype = CTF_V2_MAX_PTYPE;
+
+	static int kind(uint_t info) { return (CTF_V2_INFO_KIND(info)); }
+	static ulong_t vlen(uint_t info) { return (CTF_V2_INFO_VLEN(info)); }
+	static bool is_root(uint_t info) { return (CTF_V2_INFO_ISROOT(info)); }
 };
 
-struct CtfTypeParser_V3 : CtfTypeParser {
+struct CtfV3 {
+	using type_t = struct ctf_type_v3;
+	using stype_t = struct ctf_stype_v3;
+	using array_t = struct ctf_array_v3;
+	using member_t = struct ctf_member_v3;
+	using lmember_t = struct ctf_lmember_v3;
+
+	static constexpr size_t id_width = 4;
+	static constexpr uint_t lsize_sent = CTF_V3_LSIZE_SENT;
+	static constexpr size_t lstruct_thresh = CTF_V3_LSTRUCT_THRESH;
+	static constexpr int parent_shift = CTF_V3_PARENT_SHIFT;
+	static constexpr uint_t max_type = CTF_V3_MAX_TYPE;
+	static constexpr uint_t max_ptype = CTF_V3_MAX_PTYPE;
+
+	static int kind(uint_t info) { return (CTF_V3_INFO_KIND(info)); }
+	static ulong_t vlen(uint_t info) { return (CTF_V3_INFO_VLEN(info)); }
+	static bool is_root(uint_t info) { return (CTF_V3_INFO_ISROOT(info)); }
+};
+
+/* a copy of the fixed part of a type record, the variable part follows */
+template <typename V> struct CtfRecord {
     private:
-	struct ctf_type_v3 t;
+	typename V::type_t t;
 
     public:
-	/* virtual function */
-	virtual bool is_root() const override;
-	virtual int kind() const override;
-	virtual ulong_t vlen() const override;
-	virtual uint_t name() const override;
-	virtual uint_t type() const override;
-	virtual size_t increment() const override;
-	virtual size_t size() const override;
-	virtual ArrayEntry do_array(const std::byte *bytes) const override;
-	virtual std::pair<size_t, std::vector<MemberEntry>>
-	do_struct(const std::byte *,
-	    const std::function<std::string_view(uint)> &) const override;
+	/* the short form is a prefix of the long one, read no more than that */
+	CtfRecord(const std::byte *data)
+	{
+		memcpy(&t, data, sizeof(typename V::stype_t));
+		if (t.ctt_size == V::lsize_sent)
+			memcpy(&t, data, sizeof(t));
+	}
+
+	bool is_root() const { return (V::is_root(t.ctt_info)); }
+	int kind() const { return (V::kind(t.ctt_info)); }
+	ulong_t vlen() const { return (V::vlen(t.ctt_info)); }
+	uint_t name() const { return (t.ctt_name); }
+	uint_t type() const { return (t.ctt_type); }
+
+	/* bytes of the fixed part */
+	size_t
+	increment() const
+	{
+		return (t.ctt_size == V::lsize_sent ? sizeof(typename V::type_t) :
+						      sizeof(typename V::stype_t));
+	}
+
+	size_t
+	size() const
+	{
+		return (t.ctt_size == V::lsize_sent ? CTF_TYPE_LSIZE(&t) :
+						      t.ctt_size);
+	}
+
+	/* bytes of the variable part */
+	size_t
+	vlen_bytes() const
+	{
+		size_t n = vlen();
+
+		switch (kind()) {
+		case CTF_K_INTEGER:
+		case CTF_K_FLOAT:
+			return (sizeof(uint32_t));
+		case CTF_K_ARRAY:
+			return (sizeof(typename V::array_t));
+		case CTF_K_FUNCTION:
+			return (roundup2(V::id_width * n, 4));
+		case CTF_K_STRUCT:
+		case CTF_K_UNION:
+			return (n * (size() >= V::lstruct_thresh ?
+					    sizeof(typename V::lmember_t) :
+					    sizeof(typename V::member_t)));
+		case CTF_K_ENUM:
+			return (sizeof(ctf_enum_t) * n);
+		default:
+			return (0);
+		}
+	}
+
+	ArrayEntry
+	array(const std::byte *bytes) const
+	{
+		typename V::array_t arr;
+
+		memcpy(&arr, bytes, sizeof(arr));
+		return { arr.cta_contents, arr.cta_index, arr.cta_nelems };
+	}
+
+	/* the members of a struct or union, named by get_str */
+	template <typename Resolve>
+	MemberList
+	members(const std::byte *bytes, const Resolve &get_str) const
+	{
+		MemberList res;
+		ulong_t n = vlen();
+
+		res.reserve(n);
+		if (size() >= V::lstruct_thresh) {
+			const auto *iter =
+			    reinterpret_cast<const typename V::lmember_t *>(bytes);
+			for (ulong_t i = 0; i < n; ++i, ++iter)
+				res.push_back({ get_str(iter->ctlm_name),
+				    iter->ctlm_type, CTF_LMEM_OFFSET(iter) });
+		} else {
+			const auto *iter =
+			    reinterpret_cast<const typename V::member_t *>(bytes);
+			for (ulong_t i = 0; i < n; ++i, ++iter)
+				res.push_back({ get_str(iter->ctm_name),
+				    iter->ctm_type, iter->ctm_offset });
+		}
+
+		return (res);
+	}
+};
 
-	/* static function */
-	static CtfTypeParser *create_symbol(const std::byte *data);
+/* what a type keeps of its record */
+struct CtfTypeHead {
+	int kind = CTF_K_UNKNOWN;
+	size_t size = 0; /* size, or ctt_type for kinds without one */
 };
 
 struct CtfType {
     protected:
 	using CompareFunc = std::function<bool(const CtfType &lhs,
 	    const CtfType &rhs, uint32_t l_child_id, uint32_t r_child_id)>;
-	CtfTypeParser *parser;
+	CtfTypeHead head;
 	std::string_view name_str;
-	ShrCtfData owned_ctf;
+	const CtfData *owned_ctf; /* the file owning this type */
 	uint32_t id;
 
 	/* virtual function */
@@ -107,29 +219,46 @@ struct CtfType {
 
 	/* static function */
 	static bool do_compare(const CtfType &lhs, const CtfType &rhs,
-	    std::unordered_set<uint64_t> &visited,
-	    std::unordered_map<uint64_t, bool>
+	    CompareVisited &visited,
+	    CompareCache
 		&cache); /* internal function for compare two types */
+	static bool do_compare_resolved(const CtfType &lhs, const CtfType &rhs,
+	    CompareVisited &visited,
+	    CompareCache &cache);
 	static bool do_compare_child(const CtfType &lhs, const CtfType &rhs,
 	    uint32_t l_child_id, uint32_t r_child_id,
-	    std::unordered_set<uint64_t> &visited,
-	    std::unordered_map<uint64_t, bool> &cache);
+	    CompareVisited &visited,
+	    CompareCache &cache);
 
     public:
 	/* constructor */
-	CtfType(CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name, ShrCtfData owned_ctf)
-	    : parser(parser)
+	CtfType(CtfTypeHead head, uint32_t id,
+	    const std::string_view &name, const CtfData *owned_ctf)
+	    : head(head)
 	    , name_str(name)
 	    , owned_ctf(owned_ctf)
 	    , id(id) {};
-	virtual ~CtfType();
+	virtual ~CtfType() = default;
+
+	/* virtual function */
+	virtual void print_diff(const CtfType &rhs,
+	    CompareCache &cache, std::ostream &out)
+	    const; /* print the detail of how rhs differs from this type */
 
 	/* member function */
 	inline const std::string_view &name() const { return name_str; }
-	inline ShrCtfData get_owned() const { return owned_ctf; }
+	inline const CtfData *get_owned() const { return owned_ctf; }
+	inline uint32_t type_id() const { return id; }
+	/* CTF_K_* of the record, and its size in CTF if the kind has one */
+	inline int kind() const { return head.kind; }
+	inline size_t type_size() const { return head.size; }
+	std::vector<uint32_t> child_ids() const; /* the types referred to */
+	const CtfType *skip_ignored()
+	    const; /* follow the qualifiers in ignore list to the real type */
+	const CtfType *resolve_forward()
+	    const; /* the definition of a forward, or the type itself */
 	bool compare(const CtfType &rhs,
-	    std::unordered_map<uint64_t, bool> &cache)
+	    CompareCache &cache)
 	    const; /* compare two ctftype with type cache */
 };
 
@@ -143,9 +272,10 @@ struct CtfTypeVaArg : CtfType {
 	    const CompareFunc &comp) const override;
 
 	/* constructor */
-	CtfTypeVaArg(CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfType(parser, id, name, owned_ctf) {};
+	CtfTypeVaArg(CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfType(head, id, name, owned_ctf) {};
 	virtual ~CtfTypeVaArg() = default;
 };
 
@@ -163,11 +293,15 @@ struct CtfTypePrimitive : CtfType {
 	virtual uint32_t width() const = 0;
 
 	/* constructor */
-	CtfTypePrimitive(uint32_t data, CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfType(parser, id, name, owned_ctf)
+	CtfTypePrimitive(uint32_t data, CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfType(head, id, name, owned_ctf)
 	    , data(data) {};
 	virtual ~CtfTypePrimitive() = default;
+
+	/* member function */
+	uint32_t raw_data() const { return data; }
 };
 
 struct CtfTypeInteger : CtfTypePrimitive {
@@ -177,9 +311,10 @@ struct CtfTypeInteger : CtfTypePrimitive {
 	virtual uint32_t width() const override;
 
 	/* cosntructor */
-	CtfTypeInteger(uint32_t data, CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfTypePrimitive(data, parser, id, name, owned_ctf) {};
+	CtfTypeInteger(uint32_t data, CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfTypePrimitive(data, head, id, name, owned_ctf) {};
 };
 
 struct CtfTypeFloat : CtfTypePrimitive {
@@ -189,9 +324,10 @@ struct CtfTypeFloat : CtfTypePrimitive {
 	virtual uint32_t width() const override;
 
 	/* constructor */
-	CtfTypeFloat(uint32_t data, CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfTypePrimitive(data, parser, id, name, owned_ctf) {};
+	CtfTypeFloat(uint32_t data, CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfTypePrimitive(data, head, id, name, owned_ctf) {};
 };
 
 struct CtfTypeArray : CtfType {
@@ -205,20 +341,23 @@ struct CtfTypeArray : CtfType {
 	    const CompareFunc &comp) const override;
 
 	/* constructor */
-	CtfTypeArray(const std::byte *data, CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfType(parser, id, name, owned_ctf)
-	    , entry(parser->do_array(data)) {};
+	CtfTypeArray(ArrayEntry entry, CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfType(head, id, name, owned_ctf)
+	    , entry(entry) {};
 
 	/* member function */
 	uint32_t members() const { return entry.nelems; };
+	uint32_t contents() const { return entry.contents; };
+	uint32_t index() const { return entry.index; };
 };
 
 struct CtfTypeFunc : CtfType {
     protected:
 	/* members */
 	uint32_t ret_id;
-	std::vector<uint32_t> args_vec;
+	ArgList args_vec;
 
     public:
 	/* virtual function */
@@ -226,47 +365,73 @@ struct CtfTypeFunc : CtfType {
 	    const CompareFunc &comp) const override;
 
 	/* constructor */
-	CtfTypeFunc(uint32_t ret_id, std::vector<uint32_t> &&args_vec,
-	    CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfType(parser, id, name, owned_ctf)
+	CtfTypeFunc(uint32_t ret_id, ArgList &&args_vec,
+	    CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfType(head, id, name, owned_ctf)
 	    , ret_id(ret_id)
-	    , args_vec(args_vec) {};
+	    , args_vec(std::move(args_vec)) {};
 
 	/* member function */
-	const std::vector<uint32_t> &args() const { return args_vec; };
+	const ArgList &args() const { return args_vec; };
 	uint32_t ret() const { return ret_id; };
 };
 
 struct CtfTypeEnum : CtfType {
     private:
 	/* member */
-	std::vector<std::pair<std::string_view, uint32_t>> members;
+	EnumList members;
 
     public:
 	/* virtual function */
 	virtual bool do_compare_impl(const CtfType &rhs,
 	    const CompareFunc &comp) const override;
+	virtual void print_diff(const CtfType &rhs,
+	    CompareCache &cache,
+	    std::ostream &out) const override;
 
 	/* constructor */
 	CtfTypeEnum(
-	    std::vector<std::pair<std::string_view, uint32_t>> &&members,
-	    CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfType(parser, id, name, owned_ctf)
-	    , members(members) {};
+	    EnumList &&members,
+	    CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfType(head, id, name, owned_ctf)
+	    , members(std::move(members)) {};
+
+	/* member function */
+	const EnumList &
+	member_list() const
+	{
+		return members;
+	}
 };
 
 struct CtfTypeForward : CtfType {
+    private:
+	/* members */
+	int tag;	   /* kind of the declared type */
+	uint32_t name_ref; /* name of the declared type in the strtab */
+
     public:
 	/* virtual function */
 	virtual bool do_compare_impl(const CtfType &rhs,
 	    const CompareFunc &comp) const override;
 
 	/* constructor */
-	CtfTypeForward(CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfType(parser, id, name, owned_ctf) {};
+	CtfTypeForward(int tag, uint32_t name_ref, CtfTypeHead head,
+	    uint32_t id, const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfType(head, id, name, owned_ctf)
+	    , tag(tag)
+	    , name_ref(name_ref) {};
+
+	/* member function */
+	int tag_kind() const { return tag; }
+	uint32_t name_index() const { return name_ref; }
+	const CtfType *definition()
+	    const; /* the full type in the same file, or nullptr */
 };
 
 struct CtfTypeQualifier : CtfType {
@@ -280,9 +445,10 @@ struct CtfTypeQualifier : CtfType {
 	    const CompareFunc &comp) const override;
 
 	/* constructor */
-	CtfTypeQualifier(uint32_t ref_id, CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfType(parser, id, name, owned_ctf)
+	CtfTypeQualifier(uint32_t ref_id, CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfType(head, id, name, owned_ctf)
 	    , ref_id(ref_id) {};
 
 	virtual ~CtfTypeQualifier() = default;
@@ -294,41 +460,46 @@ struct CtfTypeQualifier : CtfType {
 struct CtfTypePtr : CtfTypeQualifier {
     public:
 	/* constructor */
-	CtfTypePtr(uint32_t ref_id, CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfTypeQualifier(ref_id, parser, id, name, owned_ctf) {};
+	CtfTypePtr(uint32_t ref_id, CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfTypeQualifier(ref_id, head, id, name, owned_ctf) {};
 };
 
 struct CtfTypeTypeDef : CtfTypeQualifier {
     public:
 	/* constructor */
-	CtfTypeTypeDef(uint32_t ref_id, CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfTypeQualifier(ref_id, parser, id, name, owned_ctf) {};
+	CtfTypeTypeDef(uint32_t ref_id, CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfTypeQualifier(ref_id, head, id, name, owned_ctf) {};
 };
 
 struct CtfTypeVolatile : CtfTypeQualifier {
     public:
 	/* constructor */
-	CtfTypeVolatile(uint32_t ref_id, CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfTypeQualifier(ref_id, parser, id, name, owned_ctf) {};
+	CtfTypeVolatile(uint32_t ref_id, CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfTypeQualifier(ref_id, head, id, name, owned_ctf) {};
 };
 
 struct CtfTypeConst : CtfTypeQualifier {
     public:
 	/* constructor */
-	CtfTypeConst(uint32_t ref_id, CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfTypeQualifier(ref_id, parser, id, name, owned_ctf) {};
+	CtfTypeConst(uint32_t ref_id, CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfTypeQualifier(ref_id, head, id, name, owned_ctf) {};
 };
 
 struct CtfTypeRestrict : CtfTypeQualifier {
     public:
 	/* constructor */
-	CtfTypeRestrict(uint32_t ref_id, CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfTypeQualifier(ref_id, parser, id, name, owned_ctf) {};
+	CtfTypeRestrict(uint32_t ref_id, CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfTypeQualifier(ref_id, head, id, name, owned_ctf) {};
 };
 
 struct CtfTypeUnknown : CtfType {
@@ -338,26 +509,35 @@ struct CtfTypeUnknown : CtfType {
 	    const CompareFunc &comp) const override;
 
 	/* constructor */
-	CtfTypeUnknown(CtfTypeParser *parser, uint32_t id,
-	    ShrCtfData owned_ctf = nullptr)
-	    : CtfType(parser, id, "", owned_ctf) {};
+	CtfTypeUnknown(CtfTypeHead head, uint32_t id,
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfType(head, id, "", owned_ctf) {};
 };
 
 struct CtfTypeComplex : CtfType {
     protected:
 	/* members */
 	uint32_t size;
-	std::vector<MemberEntry> args;
+	MemberList args;
 
     public:
+	/* virtual function */
+	virtual void print_diff(const CtfType &rhs,
+	    CompareCache &cache,
+	    std::ostream &out) const override;
+
 	/* constructor */
-	CtfTypeComplex(uint32_t size, std::vector<MemberEntry> &&args,
-	    CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
-	    : CtfType(parser, id, name, owned_ctf)
+	CtfTypeComplex(uint32_t size, MemberList &&args,
+	    CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
+	    : CtfType(head, id, name, owned_ctf)
 	    , size(size)
-	    , args(args) {};
+	    , args(std::move(args)) {};
 	virtual ~CtfTypeComplex() = default;
+
+	/* member function */
+	const MemberList &member_list() const { return args; }
 };
 
 struct CtfTypeStruct : CtfTypeComplex {
@@ -367,11 +547,12 @@ struct CtfTypeStruct : CtfTypeComplex {
 	    const CompareFunc &comp) const override;
 
 	/* constructor */
-	CtfTypeStruct(uint32_t size, std::vector<MemberEntry> &&args,
-	    CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
+	CtfTypeStruct(uint32_t size, MemberList &&args,
+	    CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
 	    : CtfTypeComplex(size,
-		  std::forward<std::vector<MemberEntry> &&>(args), parser, id,
+		  std::forward<MemberList &&>(args), head, id,
 		  name, owned_ctf) {};
 };
 
@@ -382,13 +563,13 @@ struct CtfTypeUnion : CtfTypeComplex {
 	    const CompareFunc &comp) const override;
 
 	/* constructor */
-	CtfTypeUnion(uint32_t size, std::vector<MemberEntry> &&args,
-	    CtfTypeParser *parser, uint32_t id,
-	    const std::string_view &name = "", ShrCtfData owned_ctf = nullptr)
+	CtfTypeUnion(uint32_t size, MemberList &&args,
+	    CtfTypeHead head, uint32_t id,
+	    const std::string_view &name = "",
+	    const CtfData *owned_ctf = nullptr)
 	    : CtfTypeComplex(size,
-		  std::forward<std::vector<MemberEntry> &&>(args), parser, id,
+		  std::forward<MemberList &&>(args), head, id,
 		  name, owned_ctf) {};
 };
 
-using CtfTypeFactory = CtfTypeParser *(*)(const std::byte *);
 using ShrCtfType = std::shared_ptr<CtfType>;
@@ -0,0 +1,418 @@
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "archive.hpp"
+#include "ctfdata.hpp"
+#include "daemon.hpp"
+#include "driver.hpp"
+#include "memacct.hpp"
+#include "metadata.hpp"
+#include "stats.hpp"
+#include "utility.hpp"
+#include <cerrno>
+#include <cstdint>
+#include <iostream>
+#include <list>
+#include <new>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+
+/*
+ * a request is the flags and the two absolute paths, one per line. The
+ * reply is the report followed by a NUL byte and the exit status. With
+ * -stats, what the daemon did for the request and the memory it holds
+ * follow the report.
+ */
+
+/* stream buffer writing to a socket */
+struct FdStreamBuf : std::streambuf {
+    private:
+	int fd;
+	char buf[BUFSIZ];
+
+	bool flush()
+	{
+		char *p = pbase();
+
+		while (p < pptr()) {
+			ssize_t n = write(fd, p, pptr() - p);
+			if (n == -1 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return (false);
+			p += n;
+		}
+		setp(buf, buf + sizeof(buf));
+		return (true);
+	}
+
+    protected:
+	int overflow(int c) override
+	{
+		if (!flush())
+			return (traits_type::eof());
+		if (c != traits_type::eof()) {
+			*pptr() = c;
+			pbump(1);
+		}
+		return (traits_type::not_eof(c));
+	}
+
+	int sync() override { return (flush() ? 0 : -1); }
+
+    public:
+	FdStreamBuf(int fd)
+	    : fd(fd)
+	{
+		setp(buf, buf + sizeof(buf));
+	}
+};
+
+/*
+ * parsed files by path. An entry is reused as long as the file keeps its
+ * mtime and size, and also when it was rewritten with the same contents.
+ */
+struct CtfCache {
+    private:
+	struct Entry {
+		std::string path;
+		struct timespec mtime;
+		off_t size;
+		uint64_t hash; /* of the CTF section and the symbols */
+		ShrCtfData data;
+	};
+
+	size_t capacity;
+	std::list<Entry> lru; /* most recently used first */
+	std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+    public:
+	CtfCache(size_t capacity)
+	    : capacity(capacity) {};
+
+	ShrCtfData get(const std::string &path, std::ostream &out);
+};
+
+ShrCtfData
+CtfCache::get(const std::string &path, std::ostream &out)
+{
+	std::string archive, member;
+	struct stat st;
+
+	/* a member of an archive changes with the archive */
+	if (stat(path.c_str(), &st) == -1 &&
+	    (!split_archive_path(path, archive, member) ||
+		stat(archive.c_str(), &st) == -1)) {
+		out << "Cannot parse file " << path << '\n';
+		return (nullptr);
+	}
+
+	auto iter = index.find(path);
+	if (iter != index.end()) {
+		Entry &e = *iter->second;
+
+		lru.splice(lru.begin(), lru, iter->second);
+		if (e.size == st.st_size &&
+		    e.mtime.tv_sec == st.st_mtim.tv_sec &&
+		    e.mtime.tv_nsec == st.st_mtim.tv_nsec)
+			return (e.data);
+	}
+
+	CtfMetaData metadata(path);
+
+	if (!metadata.is_available()) {
+		out << "Cannot parse file " << path << '\n';
+		return (nullptr);
+	}
+
+	uint64_t hash = metadata.section_hash ^ metadata.symbol_hash;
+
+	/* touched but unchanged, e.g. by a rebuild */
+	if (iter != index.end() && iter->second->hash == hash &&
+	    iter->second->data->meta_data().same_contents(metadata)) {
+		iter->second->mtime = st.st_mtim;
+		iter->second->size = st.st_size;
+		return (iter->second->data);
+	}
+
+	auto data = CtfData::create_ctf_info(std::move(metadata));
+	if (data == nullptr)
+		return (nullptr);
+
+	if (iter != index.end()) {
+		lru.erase(iter->second);
+		index.erase(iter);
+	}
+
+	lru.push_front({ path, st.st_mtim, st.st_size, hash, data });
+	index[path] = lru.begin();
+
+	/* beyond -max-memory the files not used lately are dropped early */
+	while (lru.size() > capacity || (lru.size() > 1 && mem_over_limit())) {
+		index.erase(lru.back().path);
+		lru.pop_back();
+	}
+
+	return (data);
+}
+
+static bool
+read_request(int fd, std::string &req)
+{
+	char buf[PATH_MAX];
+	ssize_t n;
+
+	while ((n = read(fd, buf, sizeof(buf))) != 0) {
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			return (false);
+		req.append(buf, n);
+	}
+
+	return (true);
+}
+
+static int
+serve_request(int fd, CtfCache &cache)
+{
+	FdStreamBuf buf(fd);
+	std::ostream out(&buf);
+	std::string req, lpath, rpath;
+	int status = 1;
+
+	if (!read_request(fd, req))
+		return (1);
+
+	size_t l = req.find('\n'), r = req.find('\n', l + 1),
+	       end = req.find('\n', r + 1);
+	if (l == std::string::npos || r == std::string::npos ||
+	    end == std::string::npos) {
+		out << "Malformed request\n" << '\0' << status << std::flush;
+		return (1);
+	}
+
+	/* the flags are global, they are set for each request */
+	flags = atoi(req.c_str());
+	ctf_stats = CtfStats();
+	ignore_ids = { &typeid(CtfTypeTypeDef) };
+	if ((flags & F_IGNORE_CONST) != 0)
+		ignore_ids.push_back(&typeid(CtfTypeConst));
+
+	lpath = req.substr(l + 1, r - l - 1);
+	rpath = req.substr(r + 1, end - r - 1);
+
+	try {
+		auto lhs = cache.get(lpath, out);
+		auto rhs = lhs != nullptr ? cache.get(rpath, out) : nullptr;
+
+		if (rhs != nullptr) {
+			if (!lhs->meta_data().same_contents(rhs->meta_data())) {
+				if ((flags & F_LAYOUT) != 0) {
+					lhs->prepare_layouts();
+					rhs->prepare_layouts();
+				}
+				diff_report(*lhs, *rhs, out);
+			}
+			status = 0;
+		}
+	} catch (const std::bad_alloc &) {
+		out << "Cannot allocate memory\n";
+		status = 1;
+	}
+
+	if ((flags & F_STATS) != 0)
+		ctf_stats.print(out);
+	out << '\0' << status << std::flush;
+	return (status);
+}
+
+static bool
+socket_address(const std::string &path, struct sockaddr_un &sun)
+{
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof(sun.sun_path)) {
+		std::cout << "Socket path too long: " << path << '\n';
+		return (false);
+	}
+
+	strcpy(sun.sun_path, path.c_str());
+	return (true);
+}
+
+int
+daemon_serve(const std::string &socket_path, size_t cache_size)
+{
+	struct sockaddr_un sun;
+	struct stat st;
+	CtfCache cache(cache_size);
+	mode_t mask;
+	int sock, fd, error;
+
+	if (!socket_address(socket_path, sun))
+		return (1);
+
+	/* replace the socket of an earlier daemon, but nothing else */
+	if (lstat(socket_path.c_str(), &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			std::cout << "Cannot listen on " << socket_path
+				  << ": file exists and is not a socket\n";
+			return (1);
+		}
+		if (unlink(socket_path.c_str()) == -1) {
+			std::cout << "Cannot remove " << socket_path << ": "
+				  << strerror(errno) << '\n';
+			return (1);
+		}
+	} else if (errno != ENOENT) {
+		std::cout << "Cannot stat " << socket_path << ": "
+			  << strerror(errno) << '\n';
+		return (1);
+	}
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		std::cout << "Cannot create socket: " << strerror(errno) << '\n';
+		return (1);
+	}
+
+	/*
+	 * whoever can connect has files opened with our privileges, so only
+	 * our user may
+	 */
+	mask = umask(0077);
+	error = bind(sock, reinterpret_cast<struct sockaddr *>(&sun),
+	    sizeof(sun));
+	(void)umask(mask);
+	if (error == -1 || listen(sock, SOMAXCONN) == -1) {
+		std::cout << "Cannot listen on " << socket_path << ": "
+			  << strerror(errno) << '\n';
+		close(sock);
+		return (1);
+	}
+
+	/* a client going away must not take the daemon with it */
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;) {
+		if ((fd = accept(sock, NULL, NULL)) == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			std::cout << "accept failed: " << strerror(errno)
+				  << '\n';
+			break;
+		}
+
+		(void)serve_request(fd, cache);
+		close(fd);
+	}
+
+	close(sock);
+	return (1);
+}
+
+/*
+ * the daemon does not share our working directory. Of archive:member only
+ * the archive is a file to resolve, the member is a name inside it.
+ */
+static bool
+absolute_path(const std::string &path, std::string &out)
+{
+	std::string archive, member;
+	char real[PATH_MAX];
+
+	if (split_archive_path(path, archive, member)) {
+		if (realpath(archive.c_str(), real) == NULL)
+			return (false);
+		out = std::string(real) + ':' + member;
+		return (true);
+	}
+
+	if (realpath(path.c_str(), real) == NULL)
+		return (false);
+	out = real;
+	return (true);
+}
+
+int
+daemon_query(const std::string &socket_path, const std::string &lhs,
+    const std::string &rhs)
+{
+	struct sockaddr_un sun;
+	std::string lreal, rreal;
+	char buf[BUFSIZ];
+	ssize_t n;
+	int sock;
+
+	if (!socket_address(socket_path, sun))
+		return (1);
+
+	if (!absolute_path(lhs, lreal)) {
+		std::cout << "Cannot parse file " << lhs << '\n';
+		return (1);
+	}
+	if (!absolute_path(rhs, rreal)) {
+		std::cout << "Cannot parse file " << rhs << '\n';
+		return (1);
+	}
+
+	if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+	    connect(sock, reinterpret_cast<struct sockaddr *>(&sun),
+		sizeof(sun)) == -1) {
+		std::cout << "Cannot connect to " << socket_path << ": "
+			  << strerror(errno) << '\n';
+		if (sock != -1)
+			close(sock);
+		return (1);
+	}
+
+	std::string req = std::to_string(flags) + '\n' + lreal + '\n' +
+	    rreal + '\n';
+	if (write(sock, req.data(), req.size()) != (ssize_t)req.size() ||
+	    shutdown(sock, SHUT_WR) == -1) {
+		std::cout << "Cannot send request: " << strerror(errno) << '\n';
+		close(sock);
+		return (1);
+	}
+
+	/* everything up to the NUL is the report, then the status */
+	std::string tail;
+	bool in_report = true;
+
+	while ((n = read(sock, buf, sizeof(buf))) != 0) {
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			break;
+
+		char *nul = in_report ?
+		    static_cast<char *>(memchr(buf, '\0', n)) :
+		    nullptr;
+
+		if (!in_report) {
+			tail.append(buf, n);
+		} else if (nul != nullptr) {
+			std::cout.write(buf, nul - buf);
+			tail.append(nul + 1, buf + n - nul - 1);
+			in_report = false;
+		} else {
+			std::cout.write(buf, n);
+		}
+	}
+
+	close(sock);
+	std::cout.flush();
+
+	return (tail.empty() ? 1 : atoi(tail.c_str()));
+}
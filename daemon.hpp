@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/*
+ * serve diff requests on a local socket. Parsed files stay in an LRU
+ * cache of cache_size entries, so a query against a file that was asked
+ * for before only pays for the other file.
+ */
+int daemon_serve(const std::string &socket_path, size_t cache_size);
+
+/*
+ * ask the daemon listening on socket_path for the report of lhs against
+ * rhs with the current flags, and copy it to the standard output
+ */
+int daemon_query(const std::string &socket_path, const std::string &lhs,
+    const std::string &rhs);
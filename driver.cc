@@ -0,0 +1,664 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sys/elf_common.h"
+
+#include "archive.hpp"
+#include "ctfdata.hpp"
+#include "driver.hpp"
+#include "fingerprint.hpp"
+#include "index.hpp"
+#include "metadata.hpp"
+#include "stats.hpp"
+#include "utility.hpp"
+#include "workpool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/* the budgets shared by all jobs of one run */
+struct DriverBudget {
+	ResourceBudget files;
+	ResourceBudget bytes;
+
+	DriverBudget(const DriverLimits &limits)
+	    : files(limits.max_files)
+	    , bytes(limits.max_bytes) {};
+};
+
+void
+diff_report(const CtfData &lhs, const CtfData &rhs, std::ostream &out)
+{
+	lhs.compare_and_get_diff(rhs, out);
+
+	if ((flags & F_LAYOUT) != 0)
+		lhs.print_layout_diff(rhs, out);
+}
+
+/* returns nullptr, after telling why, when filename can not be loaded */
+static ShrCtfData
+load_file(const std::string &filename)
+{
+	CtfMetaData metadata(filename);
+
+	if (!metadata.is_available()) {
+		std::cout << "Cannot parse file " << filename << '\n';
+		return (nullptr);
+	}
+
+	return (CtfData::create_ctf_info(std::move(metadata)));
+}
+
+/*
+ * read path if it is a fingerprint file. When the file it was taken from
+ * is still there unchanged, path is replaced by it for a full compare.
+ */
+static bool
+load_prints(std::string &path, std::optional<CtfSymbolPrints> &prints)
+{
+	if (!CtfSymbolPrints::is_print_file(path))
+		return (true);
+
+	if (!(prints = CtfSymbolPrints::read(path)))
+		return (false);
+
+	CtfMetaData source(prints->source);
+
+	if (source.is_available() &&
+	    source.section_hash == prints->section_hash &&
+	    source.symbol_hash == prints->symbol_hash) {
+		path = prints->source;
+		prints.reset();
+	}
+
+	return (true);
+}
+
+static int
+diff_prints(const std::string &lpath, std::optional<CtfSymbolPrints> &lhs,
+    const std::string &rpath, std::optional<CtfSymbolPrints> &rhs)
+{
+	for (auto [path, prints] : { std::pair { &lpath, &lhs },
+		 std::pair { &rpath, &rhs } }) {
+		if (*prints)
+			continue;
+
+		auto info = load_file(*path);
+		if (info == nullptr)
+			return (1);
+		*prints = CtfSymbolPrints::from_data(*info);
+	}
+
+	if (lhs->flags != rhs->flags) {
+		std::cout << "Fingerprints of " << lpath << " and " << rpath
+			  << " were taken with different options\n";
+		return (1);
+	}
+
+	lhs->diff(*rhs, std::cout);
+	return (0);
+}
+
+int
+diff_files(const std::string &lpath, const std::string &rpath)
+{
+	std::optional<CtfSymbolPrints> lprints, rprints;
+	std::string l = lpath, r = rpath;
+
+	if (!load_prints(l, lprints) || !load_prints(r, rprints))
+		return (1);
+
+	if (lprints || rprints)
+		return (diff_prints(l, lprints, r, rprints));
+
+	CtfMetaData lhs(l);
+
+	if (!lhs.is_available()) {
+		std::cout << "Cannot parse file " << l << '\n';
+		return (1);
+	}
+
+	CtfMetaData rhs(r);
+
+	if (!rhs.is_available()) {
+		std::cout << "Cannot parse file " << r << '\n';
+		return (1);
+	}
+
+	/* byte identical CTF and symbols can not differ */
+	if (lhs.same_contents(rhs))
+		return (0);
+
+	auto l_info = CtfData::create_ctf_info(std::move(lhs));
+	if (l_info == nullptr)
+		return (1);
+
+	auto r_info = CtfData::create_ctf_info(std::move(rhs));
+	if (r_info == nullptr)
+		return (1);
+
+	std::ostringstream report;
+	{
+		CtfPhaseTimer timer(P_COMPARE);
+
+		diff_report(*l_info, *r_info, report);
+	}
+	{
+		CtfPhaseTimer timer(P_OUTPUT);
+
+		std::cout << report.str() << std::flush;
+	}
+
+	return (0);
+}
+
+int
+print_fingerprints(const std::string &filename, std::ostream &out)
+{
+	auto info = load_file(filename);
+
+	if (info == nullptr)
+		return (1);
+
+	CtfSymbolPrints::from_data(*info).write(out);
+	return (0);
+}
+
+/*
+ * walk builds in order, keeping the parsed previous build and its
+ * fingerprints. A build whose CTF and symbols are byte identical to the
+ * previous one takes over its fingerprints without being parsed, others
+ * are parsed once and compared by fingerprint, so unchanged symbols cost
+ * a hash compare. Each symbol is reported under the first build in which
+ * it was added, removed or changed.
+ */
+int
+diff_history(const std::vector<std::string> &builds)
+{
+	std::set<std::pair<char, std::string>> reported;
+	std::optional<CtfSymbolPrints> prev;
+	ShrCtfData prev_info;
+
+	for (size_t i = 0; i < builds.size(); ++i) {
+		std::optional<CtfSymbolPrints> prints;
+		std::string path = builds[i];
+		ShrCtfData info;
+
+		if (!load_prints(path, prints))
+			return (1);
+
+		if (!prints) {
+			CtfMetaData metadata(path);
+
+			if (!metadata.is_available()) {
+				std::cout << "Cannot parse file " << path
+					  << '\n';
+				return (1);
+			}
+
+			if (prev_info != nullptr &&
+			    metadata.same_contents(prev_info->meta_data())) {
+				prints = prev;
+				info = prev_info;
+			} else {
+				info = CtfData::create_ctf_info(
+				    std::move(metadata));
+				if (info == nullptr)
+					return (1);
+				prints = CtfSymbolPrints::from_data(*info);
+			}
+		}
+
+		if (prev && prev->flags != prints->flags) {
+			std::cout << "Fingerprints of " << builds[i - 1]
+				  << " and " << builds[i]
+				  << " were taken with different options\n";
+			return (1);
+		}
+
+		if (prev) {
+			std::ostringstream report;
+
+			prev->changes(*prints,
+			    [&](char kind, const CtfSymbolPrints::Entry *lhs,
+				const CtfSymbolPrints::Entry *rhs) {
+				    const auto &e = lhs != nullptr ? *lhs : *rhs;
+
+				    if (!reported.emplace(kind, e.name).second)
+					    return;
+				    if (lhs != nullptr)
+					    report << "< [" << lhs->id << "] "
+						   << lhs->name << '\n';
+				    if (rhs != nullptr)
+					    report << "> [" << rhs->id << "] "
+						   << rhs->name << '\n';
+			    });
+
+			if (report.tellp() > 0)
+				std::cout << "--- " << builds[i - 1] << "\n+++ "
+					  << builds[i] << '\n'
+					  << report.str();
+		}
+
+		prev = std::move(prints);
+		prev_info = std::move(info);
+	}
+
+	return (0);
+}
+
+/*
+ * run n jobs on a pool and print what each of them wrote in index order,
+ * as soon as all jobs before it are finished. Returns false if any job
+ * failed.
+ */
+static bool
+run_ordered(size_t n, unsigned jobs,
+    const std::function<bool(size_t, std::ostream &)> &job)
+{
+	std::vector<std::string> reports(n);
+	std::vector<bool> done(n, false);
+	std::atomic<bool> failed = false;
+	std::mutex lock;
+	std::condition_variable cv;
+	WorkPool pool(std::min<size_t>(jobs, std::max<size_t>(n, 1)));
+
+	for (size_t i = 0; i < n; ++i) {
+		pool.submit([&, i]() {
+			std::ostringstream out;
+
+			/* one file beyond -max-memory does not stop the others */
+			try {
+				if (!job(i, out))
+					failed = true;
+			} catch (const std::bad_alloc &) {
+				out << "Cannot allocate memory\n";
+				failed = true;
+			}
+			ctf_stats_fold();
+
+			std::lock_guard<std::mutex> guard(lock);
+			reports[i] = out.str();
+			done[i] = true;
+			cv.notify_all();
+		});
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		std::unique_lock<std::mutex> guard(lock);
+		cv.wait(guard, [&]() { return (done[i]); });
+
+		std::cout << reports[i];
+		reports[i].clear();
+		reports[i].shrink_to_fit();
+	}
+
+	pool.wait();
+	return (!failed);
+}
+
+/* returns false when the candidate can not be loaded */
+static bool
+diff_candidate(const CtfData &base, const std::string &filename,
+    DriverBudget &budget, std::ostream &out)
+{
+	BudgetHold files(budget.files, 1);
+	CtfMetaData metadata(filename);
+
+	if (!metadata.is_available()) {
+		out << "Cannot parse file " << filename << '\n';
+		return (false);
+	}
+
+	if (base.meta_data().same_contents(metadata))
+		return (true);
+
+	BudgetHold bytes(budget.bytes, metadata.resident_size());
+
+	auto info = CtfData::create_ctf_info(std::move(metadata));
+	if (info != nullptr)
+		diff_report(base, *info, out);
+
+	return (true);
+}
+
+int
+diff_batch(const std::string &baseline,
+    const std::vector<std::string> &candidates, const DriverLimits &limits)
+{
+	CtfMetaData metadata(baseline);
+
+	if (!metadata.is_available()) {
+		std::cout << "Cannot parse file " << baseline << '\n';
+		return (1);
+	}
+
+	auto base = CtfData::create_ctf_info(std::move(metadata));
+	if (base == nullptr)
+		return (1);
+
+	DriverBudget budget(limits);
+	auto job = [&](size_t i, std::ostream &out) {
+		out << "--- " << baseline << '\n'
+		    << "+++ " << candidates[i] << '\n';
+		return (diff_candidate(*base, candidates[i], budget, out));
+	};
+
+	return (run_ordered(candidates.size(), limits.jobs, job) ? 0 : 1);
+}
+
+/* returns false when either file can not be loaded */
+static bool
+diff_pair(const std::string &lpath, const std::string &rpath,
+    DriverBudget &budget, std::ostream &out)
+{
+	std::ostringstream report;
+
+	{
+		BudgetHold files(budget.files, 2);
+		CtfMetaData lhs(lpath);
+		CtfMetaData rhs(rpath);
+
+		if (!lhs.is_available() || !rhs.is_available()) {
+			out << "Cannot parse file "
+			    << (lhs.is_available() ? rpath : lpath) << '\n';
+			return (false);
+		}
+
+		if (lhs.same_contents(rhs))
+			return (true);
+
+		BudgetHold bytes(budget.bytes,
+		    lhs.resident_size() + rhs.resident_size());
+
+		auto l_info = CtfData::create_ctf_info(std::move(lhs));
+		auto r_info = l_info != nullptr ?
+		    CtfData::create_ctf_info(std::move(rhs)) :
+		    nullptr;
+
+		if (r_info != nullptr)
+			diff_report(*l_info, *r_info, report);
+	}
+
+	/* identical modules stay silent */
+	if (report.tellp() > 0) {
+		out << "--- " << lpath << '\n'
+		    << "+++ " << rpath << '\n'
+		    << report.str();
+	}
+
+	return (true);
+}
+
+static bool
+is_elf_file(const fs::path &path)
+{
+	char magic[SELFMAG];
+	int fd;
+
+	if ((fd = open(path.c_str(), O_RDONLY)) == -1)
+		return (false);
+
+	bool elf = read(fd, magic, SELFMAG) == SELFMAG &&
+	    memcmp(magic, ELFMAG, SELFMAG) == 0;
+	close(fd);
+
+	return (elf);
+}
+
+/*
+ * the relative paths of all ELF files below dir, sorted. dir may also be
+ * a tar archive, whose ELF members are listed instead.
+ */
+static bool
+collect_tree(const std::string &dir, std::vector<std::string> &paths)
+{
+	std::error_code ec;
+
+	if (is_archive(dir)) {
+		auto archive = Archive::open(dir);
+
+		if (archive == nullptr)
+			return (false);
+
+		for (const ArchiveMember &m : archive->contents())
+			if (m.elf)
+				paths.push_back(m.name);
+		return (true);
+	}
+	fs::recursive_directory_iterator it(dir, ec), end;
+
+	if (ec) {
+		std::cout << "Cannot open directory " << dir << ": "
+			  << ec.message() << '\n';
+		return (false);
+	}
+
+	for (; it != end; it.increment(ec)) {
+		if (ec) {
+			std::cout << "Cannot read directory " << dir << ": "
+				  << ec.message() << '\n';
+			return (false);
+		}
+
+		if (it->is_regular_file(ec) && is_elf_file(it->path()))
+			paths.push_back(
+			    it->path().lexically_relative(dir).string());
+	}
+
+	std::sort(paths.begin(), paths.end());
+	return (true);
+}
+
+/* path below the root of a tree, as archive:member for an archive */
+static std::string
+tree_file(const std::string &root, bool archive, const std::string &path)
+{
+	if (archive)
+		return (root + ":" + path);
+	return ((fs::path(root) / path).string());
+}
+
+int
+diff_tree(const std::string &ldir, const std::string &rdir,
+    const DriverLimits &limits)
+{
+	struct TreeEntry {
+		std::string path;
+		bool in_lhs;
+		bool in_rhs;
+	};
+
+	std::vector<std::string> lpaths, rpaths;
+	std::vector<TreeEntry> entries;
+	bool larchive = is_archive(ldir), rarchive = is_archive(rdir);
+
+	if (!collect_tree(ldir, lpaths) || !collect_tree(rdir, rpaths))
+		return (1);
+
+	size_t l = 0, r = 0;
+	while (l < lpaths.size() || r < rpaths.size()) {
+		if (r == rpaths.size() ||
+		    (l < lpaths.size() && lpaths[l] < rpaths[r]))
+			entries.push_back({ lpaths[l++], true, false });
+		else if (l == lpaths.size() || rpaths[r] < lpaths[l])
+			entries.push_back({ rpaths[r++], false, true });
+		else {
+			entries.push_back({ lpaths[l++], true, true });
+			++r;
+		}
+	}
+
+	DriverBudget budget(limits);
+	auto job = [&](size_t i, std::ostream &out) {
+		const TreeEntry &e = entries[i];
+
+		if (!e.in_rhs) {
+			out << "Only in " << ldir << ": " << e.path << '\n';
+			return (true);
+		}
+
+		if (!e.in_lhs) {
+			out << "Only in " << rdir << ": " << e.path << '\n';
+			return (true);
+		}
+
+		return (diff_pair(tree_file(ldir, larchive, e.path),
+		    tree_file(rdir, rarchive, e.path), budget, out));
+	};
+
+	return (run_ordered(entries.size(), limits.jobs, job) ? 0 : 1);
+}
+
+/* the fingerprints of filename, taken within the budget */
+static bool
+cluster_prints(const std::string &filename, DriverBudget &budget,
+    std::optional<CtfSymbolPrints> &prints, std::ostream &out)
+{
+	std::string path = filename;
+
+	if (!load_prints(path, prints))
+		return (false);
+	if (prints)
+		return (true);
+
+	BudgetHold files(budget.files, 1);
+	CtfMetaData metadata(path);
+
+	if (!metadata.is_available()) {
+		out << "Cannot parse file " << path << '\n';
+		return (false);
+	}
+
+	BudgetHold bytes(budget.bytes, metadata.resident_size());
+
+	auto info = CtfData::create_ctf_info(std::move(metadata));
+	if (info != nullptr)
+		prints = CtfSymbolPrints::from_data(*info);
+
+	return (prints.has_value());
+}
+
+/*
+ * fingerprint every file on the pool, then number the distinct deep
+ * hashes of each symbol in file order. Files sharing a letter in the row
+ * of a symbol share its ABI, '-' marks a file without the symbol. Symbols
+ * identical in every file are only counted.
+ */
+int
+cluster_files(const std::vector<std::string> &filenames,
+    const DriverLimits &limits)
+{
+	static constexpr std::string_view class_names =
+	    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+	std::vector<std::optional<CtfSymbolPrints>> prints(filenames.size());
+	std::map<std::pair<char, std::string>,
+	    std::vector<std::optional<uint64_t>>>
+	    symbols;
+	size_t uniform = 0;
+	DriverBudget budget(limits);
+
+	auto job = [&](size_t i, std::ostream &out) {
+		return (cluster_prints(filenames[i], budget, prints[i], out));
+	};
+
+	if (!run_ordered(filenames.size(), limits.jobs, job))
+		return (1);
+
+	for (size_t i = 0; i < prints.size(); ++i) {
+		if (prints[i]->flags != prints[0]->flags) {
+			std::cout << "Fingerprints of " << filenames[0]
+				  << " and " << filenames[i]
+				  << " were taken with different options\n";
+			return (1);
+		}
+
+		for (auto [kind, list] : { std::pair { 'F', &prints[i]->functions },
+			 std::pair { 'O', &prints[i]->variables } }) {
+			for (const auto &e : *list) {
+				auto &column = symbols[{ kind, e.name }];
+
+				column.resize(prints.size());
+				column[i] = e.deep;
+			}
+		}
+		prints[i].reset();
+	}
+
+	for (size_t i = 0; i < filenames.size(); ++i)
+		std::cout << i + 1 << ' ' << filenames[i] << '\n';
+
+	for (const auto &[symbol, column] : symbols) {
+		std::unordered_map<uint64_t, char> classes;
+		std::string row;
+
+		for (const auto &deep : column) {
+			if (!deep) {
+				row += '-';
+				continue;
+			}
+
+			auto [it, added] = classes.try_emplace(*deep,
+			    classes.size() < class_names.size() ?
+				class_names[classes.size()] :
+				'*');
+			row += it->second;
+		}
+
+		if (classes.size() == 1 && row.find('-') == std::string::npos) {
+			++uniform;
+			continue;
+		}
+
+		std::cout << row << ' ' << symbol.first << ' ' << symbol.second
+			  << '\n';
+	}
+
+	std::cout << uniform << " symbols identical in all files\n";
+	return (0);
+}
+
+int
+index_files(const std::vector<std::string> &filenames,
+    const DriverLimits &limits)
+{
+	DriverBudget budget(limits);
+	auto job = [&](size_t i, std::ostream &out) {
+		BudgetHold files(budget.files, 1);
+		CtfMetaData metadata(filenames[i]);
+		bool ok = false;
+
+		if (!metadata.is_available()) {
+			out << "Cannot parse file " << filenames[i] << '\n';
+			return (false);
+		}
+
+		BudgetHold bytes(budget.bytes, metadata.resident_size());
+
+		auto info = CtfData::create_ctf_info(std::move(metadata));
+		if (info != nullptr)
+			ok = info->write_index(filenames[i] + CTF_INDEX_SUFFIX);
+
+		return (ok);
+	};
+
+	return (run_ordered(filenames.size(), limits.jobs, job) ? 0 : 1);
+}
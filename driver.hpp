@@ -0,0 +1,62 @@
+#pragma once
+
+#include "ctfdata.hpp"
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* how much work the batch and tree modes may have in flight */
+struct DriverLimits {
+	unsigned jobs = std::thread::hardware_concurrency();
+	size_t max_files = 64;	       /* files opened at the same time */
+	size_t max_bytes = 1ULL << 30; /* CTF bytes resident at the same time */
+};
+
+/* print the whole report of lhs against rhs */
+void diff_report(const CtfData &lhs, const CtfData &rhs, std::ostream &out);
+
+/*
+ * compare two files, either of which may be a fingerprint file. A
+ * fingerprint file whose source is still present and unchanged is
+ * replaced by its source for a full compare.
+ */
+int diff_files(const std::string &lhs, const std::string &rhs);
+
+/*
+ * report, for every symbol, the first of a chronological series of builds
+ * in which its type changed. At most two builds are held at a time.
+ */
+int diff_history(const std::vector<std::string> &builds);
+
+/* write the fingerprints of the symbols of file to out */
+int print_fingerprints(const std::string &filename, std::ostream &out);
+
+/*
+ * compare one baseline against many candidates. The baseline is parsed
+ * once and shared read-only, candidates are parsed and compared on a pool
+ * of limits.jobs threads and their reports are printed in argument order.
+ */
+int diff_batch(const std::string &baseline,
+    const std::vector<std::string> &candidates, const DriverLimits &limits);
+
+/*
+ * compare every ELF file below ldir against the file with the same
+ * relative path below rdir. Files found on one side only are reported as
+ * removed or added, the reports are printed in path order.
+ */
+int diff_tree(const std::string &ldir, const std::string &rdir,
+    const DriverLimits &limits);
+
+/*
+ * group files by the ABI of each symbol. The fingerprints of the files are
+ * taken on a pool of limits.jobs threads, a row of classes is printed for
+ * every symbol that is not identical in all files.
+ */
+int cluster_files(const std::vector<std::string> &filenames,
+    const DriverLimits &limits);
+
+/* write the index sidecar of every file, see index.hpp */
+int index_files(const std::vector<std::string> &filenames,
+    const DriverLimits &limits);
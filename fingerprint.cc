@@ -0,0 +1,534 @@
+#include <limits.h>
+#include <stdlib.h>
+
+#include "ctfdata.hpp"
+#include "ctftype.hpp"
+#include "fingerprint.hpp"
+#include "hash.hpp"
+#include "utility.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/*
+ * rounds of refinement inside a cycle of types. Two cyclic types whose
+ * only difference is further than this many steps around the cycle get
+ * the same fingerprint. That can not happen when both cycles settle into
+ * at most FP_EXACT_CLASSES kinds of types, see hash_scc.
+ */
+#define FP_CYCLE_ROUNDS 64
+#define FP_EXACT_CLASSES ((FP_CYCLE_ROUNDS - 2) / 2)
+
+#define FP_MISSING (-1)  /* kid that is not in the file */
+#define FP_EXTERNAL (-2) /* index of a node owned by the parent */
+
+static uint64_t
+hash_str(std::string_view s)
+{
+	return (ctf_hash(s.data(), s.size()));
+}
+
+/*
+ * the graph seen by the compare engine: ignored qualifiers are skipped
+ * and forwards are replaced by their definition, so each node stands for
+ * what CtfType::compare looks at
+ */
+struct FpGraph {
+	struct Node {
+		const CtfType *type;
+		uint64_t local; /* everything but the referenced types */
+		std::vector<int> kids;
+		std::vector<uint64_t> salts; /* hashes of the missing kids */
+		int index = -1, low = -1;
+		int scc = -1;
+		bool on_stack = false;
+		uint64_t hash = 0;
+	};
+
+	const CtfData &data;
+	std::vector<Node> nodes;
+	std::unordered_map<const CtfType *, int> node_of;
+	std::vector<int> stack;
+	int counter = 0, sccs = 0;
+	bool exact = true;   /* equal fingerprints mean equal types */
+	bool unique = false; /* some fingerprint is of this run only */
+
+	FpGraph(const CtfData &data)
+	    : data(data) {};
+
+	int node(const CtfType *type);
+	int node(const CtfType &owner, uint32_t id);
+	void expand(int v);
+	void visit(int root);
+	void hash_scc(std::vector<int> &scc);
+};
+
+uint64_t
+ctf_unique_print(const void *owner, uint32_t id)
+{
+	/* drawn once, so that other processes do not repeat our values */
+	static const uint64_t nonce = (uint64_t)arc4random() << 32 |
+	    arc4random();
+	uint64_t h = ctf_hash_combine(nonce, reinterpret_cast<uintptr_t>(owner));
+
+	return (ctf_hash_combine(h, id));
+}
+
+/* what do_compare_impl of the type checks besides its children */
+uint64_t
+ctf_local_hash(const CtfType &type)
+{
+	uint64_t h = ctf_hash_combine(0, type.kind());
+
+	if (typeid(type) == typeid(CtfTypeVaArg))
+		return (ctf_hash_combine(h, hash_str("...")));
+
+	switch (type.kind()) {
+	case CTF_K_INTEGER:
+	case CTF_K_FLOAT:
+		h = ctf_hash_combine(h,
+		    dynamic_cast<const CtfTypePrimitive &>(type).raw_data());
+		break;
+	case CTF_K_ARRAY:
+		h = ctf_hash_combine(h,
+		    dynamic_cast<const CtfTypeArray &>(type).members());
+		break;
+	case CTF_K_FUNCTION:
+		h = ctf_hash_combine(h,
+		    dynamic_cast<const CtfTypeFunc &>(type).args().size());
+		break;
+	case CTF_K_STRUCT:
+	case CTF_K_UNION: {
+		const auto &memb =
+		    dynamic_cast<const CtfTypeComplex &>(type).member_list();
+
+		h = ctf_hash_combine(h, type.type_size());
+		h = ctf_hash_combine(h, memb.size());
+		for (const auto &m : memb)
+			h = ctf_hash_combine(h, m.offset);
+		break;
+	}
+	case CTF_K_ENUM:
+		for (const auto &[name, value] :
+		    dynamic_cast<const CtfTypeEnum &>(type).member_list()) {
+			h = ctf_hash_combine(h, hash_str(name));
+			h = ctf_hash_combine(h, value);
+		}
+		break;
+	case CTF_K_FORWARD:
+		/* a forward without definition only matches by tag and name */
+		h = ctf_hash_combine(h,
+		    dynamic_cast<const CtfTypeForward &>(type).tag_kind());
+		h = ctf_hash_combine(h, hash_str(type.name()));
+		break;
+	}
+
+	return (h);
+}
+
+int
+FpGraph::node(const CtfType *type)
+{
+	type = type->skip_ignored()->resolve_forward();
+
+	auto [iter, inserted] = node_of.emplace(type, (int)nodes.size());
+	if (!inserted)
+		return (iter->second);
+
+	nodes.push_back({ type, ctf_local_hash(*type), {}, {} });
+
+	/* types of the parent are final, they never refer back to us */
+	if (type->get_owned() != &data) {
+		nodes.back().index = FP_EXTERNAL;
+		nodes.back().hash = type->get_owned()->fingerprint(
+		    type->type_id());
+		exact = exact && type->get_owned()->exact_fingerprints();
+	}
+
+	return (iter->second);
+}
+
+int
+FpGraph::node(const CtfType &owner, uint32_t id)
+{
+	const ShrCtfType *type = owner.get_owned()->find_type(id);
+
+	return (type != nullptr ? node(type->get()) : FP_MISSING);
+}
+
+void
+FpGraph::expand(int v)
+{
+	const CtfType &type = *nodes[v].type;
+
+	/* unknown types never compare equal, not even to themselves */
+	if (typeid(type) == typeid(CtfTypeUnknown)) {
+		nodes[v].local = ctf_unique_print(&type, type.type_id());
+		unique = true;
+		return;
+	}
+
+	/* neither do the types a file is missing */
+	for (uint32_t id : type.child_ids()) {
+		int w = node(type, id);
+
+		nodes[v].kids.push_back(w);
+		nodes[v].salts.push_back(
+		    w == FP_MISSING ? ctf_unique_print(&type, id) : 0);
+		unique = unique || w == FP_MISSING;
+	}
+}
+
+/* Tarjan's algorithm with an explicit stack, SCCs come children first */
+void
+FpGraph::visit(int root)
+{
+	std::vector<std::pair<int, size_t>> frames;
+
+	auto enter = [&](int v) {
+		nodes[v].index = nodes[v].low = counter++;
+		nodes[v].on_stack = true;
+		stack.push_back(v);
+		expand(v);
+		frames.push_back({ v, 0 });
+	};
+
+	enter(root);
+
+	while (!frames.empty()) {
+		auto &[v, pos] = frames.back();
+
+		if (pos < nodes[v].kids.size()) {
+			int w = nodes[v].kids[pos++];
+
+			if (w == FP_MISSING)
+				continue;
+			if (nodes[w].index == -1)
+				enter(w);
+			else if (nodes[w].on_stack)
+				nodes[v].low = std::min(nodes[v].low,
+				    nodes[w].index);
+			continue;
+		}
+
+		int done = v;
+		frames.pop_back();
+		if (!frames.empty()) {
+			int parent = frames.back().first;
+			nodes[parent].low = std::min(nodes[parent].low,
+			    nodes[done].low);
+		}
+
+		if (nodes[done].low != nodes[done].index)
+			continue;
+
+		std::vector<int> scc;
+		int w;
+		do {
+			w = stack.back();
+			stack.pop_back();
+			nodes[w].on_stack = false;
+			nodes[w].scc = sccs;
+			scc.push_back(w);
+		} while (w != done);
+
+		hash_scc(scc);
+		++sccs;
+	}
+}
+
+/*
+ * the children outside the SCC are final. Inside a cycle every node is
+ * refined a fixed number of rounds from the hashes of the previous
+ * round, so the result only depends on what the compare engine would
+ * walk and not on how the cycle was entered.
+ *
+ * Each round splits the nodes further by what their children looked like
+ * in the round before, until a round splits nothing. A cycle that settles
+ * into n classes this way tells apart, within n rounds, any two nodes
+ * that compare unequal, and n + m rounds suffice against a cycle of m
+ * classes in another file. When there are no more than FP_EXACT_CLASSES,
+ * equal fingerprints thus mean the types compare equal.
+ */
+void
+FpGraph::hash_scc(std::vector<int> &scc)
+{
+	int id = nodes[scc[0]].scc;
+	bool cyclic = scc.size() > 1;
+
+	for (int w : nodes[scc[0]].kids)
+		cyclic = cyclic || w == scc[0];
+
+	auto round = [&](int v, auto &&kid_hash) {
+		uint64_t h = nodes[v].local;
+		const auto &kids = nodes[v].kids;
+
+		for (size_t i = 0; i < kids.size(); ++i)
+			h = ctf_hash_combine(h,
+			    kids[i] == FP_MISSING ? nodes[v].salts[i] :
+						    kid_hash(kids[i]));
+		return (h);
+	};
+
+	if (!cyclic) {
+		nodes[scc[0]].hash = round(scc[0],
+		    [&](int w) { return (nodes[w].hash); });
+		return;
+	}
+
+	std::unordered_map<int, uint64_t> cur, next;
+	std::unordered_set<uint64_t> seen;
+	bool settled = false;
+
+	for (int v : scc) {
+		cur[v] = nodes[v].local;
+		seen.insert(cur[v]);
+	}
+
+	size_t classes = seen.size();
+
+	for (int i = 0; i < FP_CYCLE_ROUNDS; ++i) {
+		for (int v : scc)
+			next[v] = round(v, [&](int w) {
+				return (nodes[w].scc == id ? cur[w] :
+							     nodes[w].hash);
+			});
+		std::swap(cur, next);
+
+		/* the classes only ever split, past the limit it is too late */
+		if (settled || classes > FP_EXACT_CLASSES)
+			continue;
+
+		seen.clear();
+		for (int v : scc)
+			seen.insert(cur[v]);
+		settled = seen.size() == classes;
+		classes = seen.size();
+	}
+
+	exact = exact && settled && classes <= FP_EXACT_CLASSES;
+
+	for (int v : scc)
+		nodes[v].hash = ctf_hash_combine(cur[v], hash_str("cycle"));
+}
+
+std::unordered_map<uint32_t, uint64_t>
+ctf_fingerprints(const CtfData &data, bool &exact, bool &unique)
+{
+	std::unordered_map<uint32_t, uint64_t> res;
+	FpGraph graph(data);
+	auto [first, last] = data.id_range();
+	std::vector<std::pair<uint32_t, int>> roots;
+
+	/* id 0 is the ... of variadic functions */
+	for (uint64_t id = first - 1; id <= last; ++id) {
+		uint32_t tid = id == first - 1 ? 0 : id;
+		const ShrCtfType *type = data.find_type(tid);
+
+		if (type != nullptr)
+			roots.push_back({ tid, graph.node(type->get()) });
+	}
+
+	for (auto [id, v] : roots)
+		if (graph.nodes[v].index == -1)
+			graph.visit(v);
+
+	for (auto [id, v] : roots)
+		res[id] = graph.nodes[v].hash;
+
+	exact = graph.exact;
+	unique = graph.unique;
+	return (res);
+}
+
+#define FP_FILE_MAGIC "ctfdiff-fingerprint"
+#define FP_FILE_VERSION 1
+
+CtfSymbolPrints
+CtfSymbolPrints::from_data(const CtfData &data)
+{
+	CtfSymbolPrints res;
+	char path[PATH_MAX];
+	std::string source(data.meta_data().file_name());
+
+	res.flags = ::flags & F_IGNORE_CONST;
+	res.section_hash = data.meta_data().section_hash;
+	res.symbol_hash = data.meta_data().symbol_hash;
+	res.exact = data.exact_fingerprints();
+	res.source = realpath(source.c_str(), path) != NULL ? path : source;
+
+	/* symbols with a type missing in the file are skipped like in a diff */
+	auto hash = [&](const auto &ids, Entry &e) {
+		for (uint32_t id : ids) {
+			const ShrCtfType *type = data.find_type(id);
+
+			if (type == nullptr)
+				return (false);
+			e.shallow = ctf_hash_combine(e.shallow,
+			    ctf_local_hash(
+				*(*type)->skip_ignored()->resolve_forward()));
+			e.deep = ctf_hash_combine(e.deep, data.fingerprint(id));
+		}
+		return (true);
+	};
+
+	for (const auto &f : data.function_list()) {
+		Entry e = { std::string(f.name), f.id, 0, 0 };
+
+		if (hash(f.type, e))
+			res.functions.push_back(std::move(e));
+	}
+
+	for (const auto &v : data.variable_list()) {
+		Entry e = { std::string(v.name), v.id, 0, 0 };
+
+		if (hash(std::vector<uint32_t> { v.type }, e))
+			res.variables.push_back(std::move(e));
+	}
+
+	return (res);
+}
+
+/*
+ * the first line names the format, the options and the source, then
+ * there is one line per symbol: F for functions and O for data, the
+ * symbol index, the name and the shallow and deep hashes
+ */
+void
+CtfSymbolPrints::write(std::ostream &out) const
+{
+	auto hex = [](uint64_t v) {
+		std::ostringstream s;
+		s << std::hex << std::setw(16) << std::setfill('0') << v;
+		return (s.str());
+	};
+
+	out << FP_FILE_MAGIC << ' ' << FP_FILE_VERSION << ' ' << flags << ' '
+	    << hex(section_hash) << ' ' << hex(symbol_hash) << ' ' << source
+	    << '\n';
+
+	for (const auto &e : functions)
+		out << "F " << e.id << ' ' << e.name << ' ' << hex(e.shallow)
+		    << ' ' << hex(e.deep) << '\n';
+	for (const auto &e : variables)
+		out << "O " << e.id << ' ' << e.name << ' ' << hex(e.shallow)
+		    << ' ' << hex(e.deep) << '\n';
+}
+
+bool
+CtfSymbolPrints::is_print_file(const std::string &path)
+{
+	std::ifstream in(path);
+	std::string magic;
+
+	return (in >> magic && magic == FP_FILE_MAGIC);
+}
+
+std::optional<CtfSymbolPrints>
+CtfSymbolPrints::read(const std::string &path)
+{
+	std::ifstream in(path);
+	std::string line, magic, kind;
+	CtfSymbolPrints res;
+	int version, lineno = 1;
+
+	std::getline(in, line);
+	std::istringstream header(line);
+	header >> magic >> version >> res.flags >> std::hex >>
+	    res.section_hash >> res.symbol_hash >> std::ws;
+	std::getline(header, res.source);
+
+	if (!header.eof() || magic != FP_FILE_MAGIC ||
+	    version != FP_FILE_VERSION) {
+		std::cout << path << ": unsupported fingerprint file\n";
+		return (std::nullopt);
+	}
+
+	while (std::getline(in, line)) {
+		std::istringstream fields(line);
+		Entry e;
+
+		++lineno;
+		if (!(fields >> kind >> e.id >> e.name >> std::hex >>
+			e.shallow >> e.deep) ||
+		    (kind != "F" && kind != "O")) {
+			std::cout << path << ':' << lineno
+				  << ": malformed fingerprint\n";
+			return (std::nullopt);
+		}
+
+		if (symbol_selected(e.name))
+			(kind == "F" ? res.functions : res.variables)
+			    .push_back(std::move(e));
+	}
+
+	auto by_name = [](const Entry &lhs, const Entry &rhs) {
+		return (lhs.name < rhs.name);
+	};
+	std::sort(res.functions.begin(), res.functions.end(), by_name);
+	std::sort(res.variables.begin(), res.variables.end(), by_name);
+
+	return (res);
+}
+
+/*
+ * call fn for every symbol present on one side only, lhs or rhs is then
+ * nullptr, and for every symbol whose deep hash differs. Functions come
+ * before variables, each in name order.
+ */
+void
+CtfSymbolPrints::changes(const CtfSymbolPrints &rhs,
+    const std::function<void(char, const Entry *, const Entry *)> &fn) const
+{
+	auto diff_list = [&](char kind, const std::vector<Entry> &l,
+			     const std::vector<Entry> &r) {
+		size_t l_idx = 0, r_idx = 0;
+
+		while (l_idx < l.size() || r_idx < r.size()) {
+			int name_diff;
+
+			if (l_idx == l.size())
+				name_diff = 1;
+			else if (r_idx == r.size())
+				name_diff = -1;
+			else
+				name_diff = l[l_idx].name.compare(r[r_idx].name);
+
+			if (name_diff < 0)
+				fn(kind, &l[l_idx], nullptr);
+			else if (name_diff > 0)
+				fn(kind, nullptr, &r[r_idx]);
+			else if (l[l_idx].deep != r[r_idx].deep)
+				fn(kind, &l[l_idx], &r[r_idx]);
+
+			l_idx += name_diff <= 0;
+			r_idx += name_diff >= 0;
+		}
+	};
+
+	diff_list('F', functions, rhs.functions);
+	diff_list('O', variables, rhs.variables);
+}
+
+/* the same report as a full compare, without the details */
+void
+CtfSymbolPrints::diff(const CtfSymbolPrints &rhs, std::ostream &out) const
+{
+	changes(rhs, [&](char, const Entry *lhs, const Entry *rhs) {
+		if (lhs != nullptr)
+			out << "< [" << lhs->id << "] " << lhs->name << '\n';
+		if (rhs != nullptr)
+			out << "> [" << rhs->id << "] " << rhs->name << '\n';
+	});
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct CtfData;
+struct CtfType;
+
+/*
+ * structural hash of every type of data by type id, the types of the
+ * parent are taken from the fingerprints of the parent, so fingerprints of
+ * two files can be compared without the files.
+ *
+ * Types that compare unequal get different fingerprints, unless they only
+ * differ further around a cycle than the rounds of refinement reach.
+ * exact is set when no cycle of data or its parent is large enough for
+ * that; equal fingerprints of two exact files then mean equal types.
+ * Unknown and missing types compare unequal to everything and get a
+ * fingerprint of their own, different in every file and every run; unique
+ * is set when any type depends on one, its fingerprints must not be kept.
+ *
+ * The reverse does not always hold: an opaque forward compares equal to
+ * a definition of the same kind and name, but their fingerprints differ.
+ */
+std::unordered_map<uint32_t, uint64_t> ctf_fingerprints(const CtfData &data,
+    bool &exact, bool &unique);
+
+/* a fingerprint that no other type gets, in this process or any other */
+uint64_t ctf_unique_print(const void *owner, uint32_t id);
+
+/* hash of what compare checks on the type itself, without its children */
+uint64_t ctf_local_hash(const CtfType &type);
+
+/*
+ * fingerprints of the data and function symbols of a file, as written by
+ * -fingerprint. The shallow hash covers the types of the symbol itself,
+ * the deep hash everything reachable from them.
+ */
+struct CtfSymbolPrints {
+	struct Entry {
+		std::string name;
+		uint32_t id; /* index in the data or func section */
+		uint64_t shallow;
+		uint64_t deep;
+	};
+
+	int flags = 0; /* the CtfFlag bits the hashes depend on */
+	uint64_t section_hash = 0;
+	uint64_t symbol_hash = 0;
+	std::string source; /* the file the fingerprints were taken from */
+	bool exact = false; /* see ctf_fingerprints, not kept in print files */
+	std::vector<Entry> functions; /* sorted by name */
+	std::vector<Entry> variables; /* sorted by name */
+
+	static CtfSymbolPrints from_data(const CtfData &data);
+	static std::optional<CtfSymbolPrints> read(const std::string &path);
+	static bool is_print_file(const std::string &path);
+	void write(std::ostream &out) const;
+	void changes(const CtfSymbolPrints &rhs,
+	    const std::function<void(char, const Entry *, const Entry *)> &fn)
+	    const;
+	void diff(const CtfSymbolPrints &rhs, std::ostream &out) const;
+};
@@ -0,0 +1,37 @@
+/*
+ * libFuzzer target for the checks of a CTF section. Every input must be
+ * rejected or pass without reading outside of it; see validate.hpp for
+ * what passing promises the decode loops. An input that passes is parsed
+ * and every type of it decoded and fingerprinted, which holds the checks
+ * to that promise.
+ */
+
+#include "ctfdata.hpp"
+#include "metadata.hpp"
+#include "validate.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+extern "C" int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	const std::byte *section = reinterpret_cast<const std::byte *>(data);
+	std::string error;
+
+	if (!ctf_check_section(section, size, error))
+		return (0);
+
+	CtfMetaData metadata("fuzz", section, size);
+	auto info = CtfData::create_ctf_info(std::move(metadata));
+
+	if (info == nullptr)
+		return (0);
+
+	auto [first, last] = info->id_range();
+
+	for (uint32_t id = first; id <= last; ++id)
+		if (info->find_type(id) != nullptr)
+			(void)info->fingerprint(id);
+	return (0);
+}
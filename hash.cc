@@ -0,0 +1,101 @@
+#include <string.h>
+
+#include "hash.hpp"
+#include <cstddef>
+#include <cstdint>
+
+static constexpr uint64_t P1 = 0x9e3779b185ebca87ULL;
+static constexpr uint64_t P2 = 0xc2b2ae3d27d4eb4fULL;
+static constexpr uint64_t P3 = 0x165667b19e3779f9ULL;
+static constexpr uint64_t P4 = 0x85ebca77c2b2ae63ULL;
+static constexpr uint64_t P5 = 0x27d4eb2f165667c5ULL;
+
+static inline uint64_t
+rotl(uint64_t x, int r)
+{
+	return ((x << r) | (x >> (64 - r)));
+}
+
+static inline uint64_t
+read64(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return (v);
+}
+
+static inline uint32_t
+read32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return (v);
+}
+
+static inline uint64_t
+mix_round(uint64_t acc, uint64_t input)
+{
+	acc += input * P2;
+	acc = rotl(acc, 31);
+	return (acc * P1);
+}
+
+static inline uint64_t
+merge_round(uint64_t acc, uint64_t val)
+{
+	acc ^= mix_round(0, val);
+	return (acc * P1 + P4);
+}
+
+uint64_t
+ctf_hash(const void *data, size_t len, uint64_t seed)
+{
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	const unsigned char *end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		uint64_t v[4] = { seed + P1 + P2, seed + P2, seed, seed - P1 };
+		const unsigned char *limit = end - 32;
+
+		do {
+			for (int i = 0; i < 4; ++i)
+				v[i] = mix_round(v[i], read64(p + 8 * i));
+			p += 32;
+		} while (p <= limit);
+
+		h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) +
+		    rotl(v[3], 18);
+		for (int i = 0; i < 4; ++i)
+			h = merge_round(h, v[i]);
+	} else {
+		h = seed + P5;
+	}
+
+	h += len;
+
+	for (; p + 8 <= end; p += 8)
+		h = rotl(h ^ mix_round(0, read64(p)), 27) * P1 + P4;
+	if (p + 4 <= end) {
+		h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+		p += 4;
+	}
+	for (; p < end; ++p)
+		h = rotl(h ^ (*p * P5), 11) * P1;
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+
+	return (h);
+}
+
+uint64_t
+ctf_hash_combine(uint64_t lhs, uint64_t rhs)
+{
+	return (mix_round(lhs ^ P5, rhs) * P3);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * 64-bit non-cryptographic hash in the style of xxHash64. The input is
+ * consumed in 32 byte stripes by four independent lanes, so the main loop
+ * has no dependency between lanes and is friendly to SIMD and wide
+ * pipelines.
+ */
+uint64_t ctf_hash(const void *data, size_t len, uint64_t seed = 0);
+
+/* combine two hash values, order matters */
+uint64_t ctf_hash_combine(uint64_t lhs, uint64_t rhs);
@@ -0,0 +1,275 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ctfdata.hpp"
+#include "index.hpp"
+#include "metadata.hpp"
+#include "utility.hpp"
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static bool
+range_fits(const CtfIndexRange &range, size_t elem, size_t size)
+{
+	return (range.offset <= size && range.offset % 8 == 0 &&
+	    range.count <= (size - range.offset) / elem);
+}
+
+/*
+ * use the sidecar of the file when it was written for the current
+ * contents of the file. A stale or broken sidecar is ignored.
+ */
+bool
+CtfMetaData::from_index_file()
+{
+	std::string path = filename + CTF_INDEX_SUFFIX;
+	struct stat src, st;
+	void *map;
+	int fd;
+
+	if (stat(filename.c_str(), &src) == -1 ||
+	    (fd = open(path.c_str(), O_RDONLY)) == -1)
+		return (false);
+
+	if (fstat(fd, &st) == -1 ||
+	    (size_t)st.st_size < sizeof(CtfIndexHeader) ||
+	    (map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+		MAP_FAILED) {
+		close(fd);
+		return (false);
+	}
+
+	const CtfIndexHeader *h = static_cast<const CtfIndexHeader *>(map);
+	size_t size = st.st_size;
+
+	if (memcmp(h->magic, CTF_INDEX_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->version != CTF_INDEX_VERSION ||
+	    h->source_size != (uint64_t)src.st_size ||
+	    h->source_mtime_sec != src.st_mtim.tv_sec ||
+	    h->source_mtime_nsec != src.st_mtim.tv_nsec ||
+	    !range_fits(h->ctf, 1, size) || !range_fits(h->names, 1, size) ||
+	    !range_fits(h->variables, sizeof(CtfIndexSymbol), size) ||
+	    !range_fits(h->functions, sizeof(CtfIndexSymbol), size) ||
+	    !range_fits(h->args, sizeof(uint32_t), size) ||
+	    !range_fits(h->fingerprints, sizeof(uint64_t), size)) {
+		munmap(map, size);
+		close(fd);
+		return (false);
+	}
+
+	std::byte *base = static_cast<std::byte *>(map);
+
+	this->data_fd = fd;
+	this->index_map = map;
+	this->index_size = size;
+	this->index = h;
+	this->ctfdata = Buffer(base + h->ctf.offset, h->ctf.count);
+	this->section = this->ctfdata;
+	this->section_hash = h->section_hash;
+	this->symbol_hash = h->symbol_hash;
+	this->pointer_size = h->pointer_size;
+
+	return (true);
+}
+
+/* the sorted symbols and the fingerprints stored in the index */
+bool CtfData::load_index()
+{
+	const CtfIndexHeader *index = metadata.index;
+	const std::byte *base = reinterpret_cast<const std::byte *>(index);
+	const char *names = reinterpret_cast<const char *>(
+		base + index->names.offset);
+	const auto *vars = reinterpret_cast<const CtfIndexSymbol *>(
+		base + index->variables.offset);
+	const auto *funcs = reinterpret_cast<const CtfIndexSymbol *>(
+		base + index->functions.offset);
+	const auto *args = reinterpret_cast<const uint32_t *>(
+		base + index->args.offset);
+	const auto *prints = reinterpret_cast<const uint64_t *>(
+		base + index->fingerprints.offset);
+
+	auto name_of = [&](uint32_t off) -> std::optional<std::string_view>
+	{
+		if (off >= index->names.count ||
+			strnlen(names + off, index->names.count - off) ==
+				index->names.count - off)
+			return (std::nullopt);
+		return (std::string_view(names + off));
+	};
+
+	for (size_t i = 0; i < index->variables.count; ++i)
+	{
+		auto name = name_of(vars[i].name);
+		if (!name)
+		{
+			std::cout << metadata.file_name()
+					  << CTF_INDEX_SUFFIX << " is corrupt\n";
+			return (false);
+		}
+		if (symbol_selected(*name))
+			static_variables.push_back({*name, vars[i].type, vars[i].id});
+	}
+
+	for (size_t i = 0; i < index->functions.count; ++i)
+	{
+		auto name = name_of(funcs[i].name);
+		if (!name || funcs[i].type > index->args.count ||
+			funcs[i].count > index->args.count - funcs[i].type)
+		{
+			std::cout << metadata.file_name()
+					  << CTF_INDEX_SUFFIX << " is corrupt\n";
+			return (false);
+		}
+		if (!symbol_selected(*name))
+			continue;
+		functions.push_back(
+			{*name,
+			 SymbolArgs(args + funcs[i].type,
+						args + funcs[i].type + funcs[i].count),
+			 funcs[i].id});
+	}
+
+	/* fingerprints depend on -f-ignore-const, others are recomputed */
+	bool ignore_const = (index->flags & CTF_INDEX_F_IGNORE_CONST) != 0;
+
+	if ((index->flags & CTF_INDEX_F_FINGERPRINTS) != 0 &&
+		ignore_const == ((flags & F_IGNORE_CONST) != 0) &&
+		index->fingerprints.count == type_offsets.size() + 1)
+	{
+		fingerprints[0] = prints[0];
+		for (size_t i = 1; i < index->fingerprints.count; ++i)
+			fingerprints[child_base + i] = prints[i];
+		fingerprints_exact = (index->flags & CTF_INDEX_F_EXACT) != 0;
+	}
+
+	return (true);
+}
+
+/* append a part aligned to 8 bytes and return where it starts */
+static CtfIndexRange
+append_part(std::string &out, const void *data, size_t size, size_t count)
+{
+	out.resize(roundup2(out.size(), 8));
+
+	CtfIndexRange range = {out.size(), count};
+	out.append(static_cast<const char *>(data), size);
+
+	return (range);
+}
+
+/*
+ * write the index of this file to path. It is written to a temporary
+ * file first and renamed, so concurrent readers see either the old or
+ * the new index.
+ */
+bool CtfData::write_index(const std::string &path) const
+{
+	CtfIndexHeader h{};
+	struct stat st;
+	std::string out, names;
+	std::vector<CtfIndexSymbol> vars, funcs;
+	std::vector<uint32_t> args;
+	std::vector<uint64_t> prints;
+	std::string source(metadata.file_name());
+
+	if (stat(source.c_str(), &st) == -1)
+	{
+		std::cout << "Cannot stat " << source << '\n';
+		return (false);
+	}
+
+	memcpy(h.magic, CTF_INDEX_MAGIC, sizeof(h.magic));
+	h.version = CTF_INDEX_VERSION;
+	h.source_size = st.st_size;
+	h.source_mtime_sec = st.st_mtim.tv_sec;
+	h.source_mtime_nsec = st.st_mtim.tv_nsec;
+	h.section_hash = metadata.section_hash;
+	h.symbol_hash = metadata.symbol_hash;
+	h.pointer_size = metadata.pointer_size;
+
+	for (const auto &v : static_variables)
+	{
+		vars.push_back({(uint32_t)names.size(), v.id, v.type, 1});
+		names.append(v.name);
+		names.push_back('\0');
+	}
+
+	for (const auto &f : functions)
+	{
+		funcs.push_back({(uint32_t)names.size(), f.id,
+						 (uint32_t)args.size(), (uint32_t)f.type.size()});
+		args.insert(args.end(), f.type.begin(), f.type.end());
+		names.append(f.name);
+		names.push_back('\0');
+	}
+
+	/*
+	 * the fingerprints of a child depend on its parent, those of unknown
+	 * and missing types on the run
+	 */
+	bool has_fingerprints = child_base == 0 && !unique_fingerprints();
+
+	if (has_fingerprints)
+		h.flags |= CTF_INDEX_F_FINGERPRINTS;
+	if (has_fingerprints && exact_fingerprints())
+		h.flags |= CTF_INDEX_F_EXACT;
+	if ((flags & F_IGNORE_CONST) != 0)
+		h.flags |= CTF_INDEX_F_IGNORE_CONST;
+
+	if (has_fingerprints)
+	{
+		prints.push_back(fingerprint(0));
+		for (size_t i = 0; i < type_offsets.size(); ++i)
+			prints.push_back(fingerprint(child_base + i + 1));
+	}
+
+	/* the section is stored inflated */
+	ctf_header_t ctf_header = *header;
+	size_t ctf_size = header->cth_stroff + header->cth_strlen;
+
+	ctf_header.cth_flags &= ~CTF_F_COMPRESS;
+	out.append(sizeof(h), '\0');
+	h.ctf = append_part(out, &ctf_header, sizeof(ctf_header),
+						sizeof(ctf_header) + ctf_size);
+	out.append(reinterpret_cast<const char *>(metadata.ctfdata.data),
+			   ctf_size);
+	h.names = append_part(out, names.data(), names.size(), names.size());
+	h.variables = append_part(out, vars.data(),
+							  vars.size() * sizeof(CtfIndexSymbol), vars.size());
+	h.functions = append_part(out, funcs.data(),
+							  funcs.size() * sizeof(CtfIndexSymbol), funcs.size());
+	h.args = append_part(out, args.data(), args.size() * sizeof(uint32_t),
+						 args.size());
+	h.fingerprints = append_part(out, prints.data(),
+								 prints.size() * sizeof(uint64_t),
+								 prints.size());
+	memcpy(out.data(), &h, sizeof(h));
+
+	std::string tmp = path + ".tmp." + std::to_string(getpid());
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	bool ok = fd != -1 &&
+			  write(fd, out.data(), out.size()) == (ssize_t)out.size();
+
+	if (fd != -1 && close(fd) == -1)
+		ok = false;
+
+	if (!ok || rename(tmp.c_str(), path.c_str()) == -1)
+	{
+		std::cout << "Cannot write " << path << ": " << strerror(errno)
+				  << '\n';
+		unlink(tmp.c_str());
+		return (false);
+	}
+
+	return (true);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Layout of the sidecar written by -index next to a file as
+ * <file>.ctfidx. It is used straight from mmap: every part is addressed
+ * by its offset from the start of the file and there are no pointers.
+ * It spares a run the inflate and the symbol table. The type records of
+ * the stored section are still checked and decoded at every load, as
+ * those of a file are.
+ */
+
+#define CTF_INDEX_MAGIC "CTFINDEX"
+#define CTF_INDEX_VERSION 2
+#define CTF_INDEX_SUFFIX ".ctfidx"
+
+#define CTF_INDEX_F_IGNORE_CONST 0x1 /* fingerprints of -f-ignore-const */
+#define CTF_INDEX_F_FINGERPRINTS 0x2 /* fingerprints are stored */
+#define CTF_INDEX_F_EXACT 0x4	     /* see ctf_fingerprints */
+
+struct CtfIndexRange {
+	uint64_t offset; /* from the start of the index */
+	uint64_t count;	 /* of elements */
+};
+
+struct CtfIndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint64_t source_size; /* of the indexed file, to detect changes */
+	int64_t source_mtime_sec;
+	int64_t source_mtime_nsec;
+	uint64_t section_hash; /* of the section as stored in the file */
+	uint64_t symbol_hash;
+	uint64_t pointer_size;
+	CtfIndexRange ctf;	 /* inflated section, bytes */
+	CtfIndexRange names;	 /* symbol names, bytes */
+	CtfIndexRange variables; /* CtfIndexSymbol sorted by name */
+	CtfIndexRange functions; /* CtfIndexSymbol sorted by name */
+	CtfIndexRange args;	 /* uint32_t, return and argument types */
+	CtfIndexRange fingerprints; /* uint64_t by type id, or none */
+};
+
+struct CtfIndexSymbol {
+	uint32_t name;	/* offset in names */
+	uint32_t id;	/* index of the symbol in the data or func section */
+	uint32_t type;	/* type of a variable, first type in args of a func */
+	uint32_t count; /* types of a function, return type included */
+};
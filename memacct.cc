@@ -0,0 +1,69 @@
+#include "memacct.hpp"
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <ostream>
+
+size_t max_memory = 0;
+
+static std::atomic<size_t> used[M_MAX];
+static std::atomic<size_t> peak[M_MAX];
+static std::atomic<size_t> total, total_peak;
+
+static void
+raise_peak(std::atomic<size_t> &peak, size_t value)
+{
+	size_t old = peak.load(std::memory_order_relaxed);
+
+	while (old < value &&
+	    !peak.compare_exchange_weak(old, value, std::memory_order_relaxed))
+		;
+}
+
+void
+mem_charge(MemTag tag, size_t bytes)
+{
+	size_t now = total.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+	if (max_memory != 0 && now > max_memory && tag != M_CACHE) {
+		total.fetch_sub(bytes, std::memory_order_relaxed);
+		throw std::bad_alloc();
+	}
+
+	raise_peak(total_peak, now);
+	raise_peak(peak[tag],
+	    used[tag].fetch_add(bytes, std::memory_order_relaxed) + bytes);
+}
+
+void
+mem_release(MemTag tag, size_t bytes)
+{
+	used[tag].fetch_sub(bytes, std::memory_order_relaxed);
+	total.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+bool
+mem_over_limit()
+{
+	return (max_memory != 0 &&
+	    total.load(std::memory_order_relaxed) > max_memory);
+}
+
+size_t
+mem_used(MemTag tag)
+{
+	return (used[tag].load(std::memory_order_relaxed));
+}
+
+void
+mem_print(std::ostream &out)
+{
+	static const char *tag_names[M_MAX] = { "types", "members", "index",
+		"symbols", "cache", "inflate" };
+
+	for (int i = 0; i < M_MAX; ++i)
+		out << "memory." << tag_names[i] << ": " << used[i]
+		    << " bytes, peak " << peak[i] << '\n';
+	out << "memory.total: " << total << " bytes, peak " << total_peak
+	    << '\n';
+}
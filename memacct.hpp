@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/* what accounted memory is used for */
+enum MemTag {
+	M_TYPES,   /* decoded types */
+	M_MEMBERS, /* members, enumerators and arguments of the types */
+	M_INDEX,   /* maps from ids and names to the types */
+	M_SYMBOLS, /* data and function symbols */
+	M_CACHE,   /* results of the type compare */
+	M_INFLATE, /* inflated CTF sections */
+	M_MAX,
+};
+
+/* -max-memory in bytes, 0 for no limit */
+extern size_t max_memory;
+
+/*
+ * add bytes to a tag. Beyond max_memory, the compare cache is still let
+ * through, it is dropped once its entry is stored, anything else throws
+ * std::bad_alloc.
+ */
+void mem_charge(MemTag tag, size_t bytes);
+void mem_release(MemTag tag, size_t bytes);
+bool mem_over_limit();
+size_t mem_used(MemTag tag);
+void mem_print(std::ostream &out); /* in use and peak of each tag */
+
+/* a std::allocator charging what it hands out to Tag */
+template <typename T, MemTag Tag> struct AcctAllocator {
+	using value_type = T;
+
+	template <typename U> struct rebind {
+		using other = AcctAllocator<U, Tag>;
+	};
+
+	AcctAllocator() = default;
+	template <typename U>
+	AcctAllocator(const AcctAllocator<U, Tag> &) noexcept {};
+
+	T *
+	allocate(size_t n)
+	{
+		mem_charge(Tag, n * sizeof(T));
+		try {
+			return (std::allocator<T>().allocate(n));
+		} catch (...) {
+			mem_release(Tag, n * sizeof(T));
+			throw;
+		}
+	}
+
+	void
+	deallocate(T *p, size_t n) noexcept
+	{
+		std::allocator<T>().deallocate(p, n);
+		mem_release(Tag, n * sizeof(T));
+	}
+
+	template <typename U>
+	bool
+	operator==(const AcctAllocator<U, Tag> &) const noexcept
+	{
+		return (true);
+	}
+
+	template <typename U>
+	bool
+	operator!=(const AcctAllocator<U, Tag> &) const noexcept
+	{
+		return (false);
+	}
+};
+
+template <typename T, MemTag Tag>
+using AcctVector = std::vector<T, AcctAllocator<T, Tag>>;
+
+template <typename K, typename V, MemTag Tag, typename Hash = std::hash<K>>
+using AcctMap = std::unordered_map<K, V, Hash, std::equal_to<K>,
+    AcctAllocator<std::pair<const K, V>, Tag>>;
+
+template <typename K, MemTag Tag>
+using AcctSet = std::unordered_set<K, std::hash<K>, std::equal_to<K>,
+    AcctAllocator<K, Tag>>;
+
+/* std::make_shared, with the object and its count charged to Tag */
+template <typename T, MemTag Tag, typename... Args>
+std::shared_ptr<T>
+acct_make_shared(Args &&...args)
+{
+	return (std::allocate_shared<T>(AcctAllocator<T, Tag>(),
+	    std::forward<Args>(args)...));
+}
@@ -4,12 +4,20 @@
 #include <fcntl.h>
 #include <gelf.h>
 #include <libelf.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "archive.hpp"
+#include "byteorder.hpp"
 #include "ctfdata.hpp"
+#include "hash.hpp"
 #include "metadata.hpp"
+#include "probes.hpp"
+#include "stats.hpp"
+#include <algorithm>
 #include <cstddef>
 #include <iostream>
+#include <utility>
 
 static Elf_Scn *
 find_section_by_name(Elf *elf, GElf_Ehdr *ehdr, const std::string &sec_name)
@@ -31,19 +39,21 @@ find_section_by_name(Elf *elf, GElf_Ehdr *ehdr, const std::string &sec_name)
 	return (nullptr);
 }
 
+/* the sections of the ELF file opened in this->elf */
 bool
-CtfMetaData::from_elf_file()
+CtfMetaData::from_elf()
 {
 	static constexpr char ctfscn_name[] = ".SUNW_ctf";
 	static constexpr char symscn_name[] = ".symtab";
 	GElf_Ehdr ehdr;
 	GElf_Shdr ctfshdr;
 
-	if ((this->elf = elf_begin(this->data_fd, ELF_C_READ, NULL)) == NULL ||
-	    gelf_getehdr(elf, &ehdr) == NULL) {
+	if (gelf_getehdr(elf, &ehdr) == NULL) {
 		return (false);
 	}
 
+	this->pointer_size = ehdr.e_ident[EI_CLASS] == ELFCLASS32 ? 4 : 8;
+
 	Elf_Scn *ctfscn = find_section_by_name(this->elf, &ehdr, ctfscn_name);
 	Elf_Data *ctfscn_data;
 
@@ -98,7 +108,6 @@ CtfMetaData::from_raw_file()
 
 	if (fstat(this->data_fd, &st) == -1) {
 		std::cout << "Failed to do fstat\n";
-		close(this->data_fd);
 		return (false);
 	}
 
@@ -107,42 +116,258 @@ CtfMetaData::from_raw_file()
 
 	if (bytes == MAP_FAILED) {
 		std::cout << "Failed to do mmap\n";
-		close(this->data_fd);
 		return (false);
 	}
 
+	this->raw_map = bytes;
+	this->raw_size = st.st_size;
 	this->ctfdata = Buffer(bytes, st.st_size);
 	return (true);
 }
 
-CtfMetaData::CtfMetaData(const std::string &filename)
-    : filename(filename)
+/*
+ * hash the section as stored and the symbols that the data and function
+ * sections are matched against, so that identical inputs can be detected
+ * before anything is inflated or parsed
+ */
+void
+CtfMetaData::hash_contents()
 {
+	GElf_Sym sym;
+	uint64_t h = 0;
+
+	this->section = ctfdata;
+	this->section_hash = ctf_hash(section.data, section.size);
+
+	for (size_t i = 0; symdata.elfdata != nullptr && i < symdata.entries;
+	     ++i) {
+		if (gelf_getsym(symdata.elfdata, i, &sym) == 0)
+			break;
+
+		u_char type = GELF_ST_TYPE(sym.st_info);
+		if (type != STT_OBJECT && type != STT_FUNC)
+			continue;
+
+		const char *name = reinterpret_cast<const char *>(
+		    strdata.data + sym.st_name);
+		uint64_t attr = type | (sym.st_shndx == SHN_UNDEF) << 8 |
+		    (sym.st_shndx == SHN_ABS && sym.st_value == 0) << 9;
+
+		h = ctf_hash_combine(h, attr);
+		h = ctf_hash_combine(h, ctf_hash(name, strlen(name)));
+	}
+
+	this->symbol_hash = h;
+}
+
+/*
+ * a member of a tar archive, read whole into memory where libelf finds its
+ * sections, as an ELF file or as a bare CTF section
+ */
+bool
+CtfMetaData::from_archive(const std::string &path, const std::string &name)
+{
+	auto archive = Archive::open(path);
+	const ArchiveMember *member;
+
+	if (archive == nullptr)
+		return (false);
+
+	if ((member = archive->find(name)) == nullptr) {
+		std::cout << "Cannot find " << name << " in archive " << path
+			  << '\n';
+		return (false);
+	}
+
+	if (!archive->read(*member, this->archived))
+		return (false);
+
+	if (member->elf) {
+		this->elf = elf_memory(reinterpret_cast<char *>(archived.data()),
+		    archived.size());
+		if (this->elf != nullptr && this->from_elf())
+			return (true);
+		if (this->elf != nullptr) {
+			elf_end(this->elf);
+			this->elf = nullptr;
+		}
+	}
+
+	this->ctfdata = Buffer(archived.data(), archived.size());
+	return (!archived.empty());
+}
+
+/* the file itself, as an ELF file or as a bare CTF section */
+bool
+CtfMetaData::from_file()
+{
+	std::string archive, member;
+
+	if (split_archive_path(filename, archive, member))
+		return (this->from_archive(archive, member));
+
 	this->data_fd = open(filename.c_str(), O_RDONLY);
-	this->elf = nullptr;
 
 	if (this->data_fd == -1) {
-		return;
+		return (false);
 	}
 
-	if (!this->from_elf_file()) {
+	if ((this->elf = elf_begin(this->data_fd, ELF_C_READ, NULL)) == NULL ||
+	    !this->from_elf()) {
+		if (this->elf != nullptr) {
+			elf_end(this->elf);
+			this->elf = nullptr;
+		}
 		if (!this->from_raw_file()) {
 			close(this->data_fd);
 			this->data_fd = -1;
+			return (false);
 		}
 	}
+
+	return (true);
+}
+
+CtfMetaData::CtfMetaData(const std::string &filename)
+    : filename(filename)
+{
+	CtfPhaseTimer timer(P_LOAD);
+
+	CTFDIFF_LOAD_START(probe_str(this->filename));
+
+	if (!this->from_index_file() && this->from_file())
+		this->hash_contents();
+
+	CTFDIFF_LOAD_DONE(probe_str(this->filename),
+	    this->is_available() ? this->ctfdata.size : 0);
+}
+
+/*
+ * a bare CTF section held in memory, named filename in messages. It is
+ * copied, so that the caller may free it and the records are aligned.
+ */
+CtfMetaData::CtfMetaData(const std::string &filename, const std::byte *data,
+    size_t size)
+    : filename(filename)
+    , archived(data, data + size)
+{
+	this->ctfdata = Buffer(archived.data(), archived.size());
+	this->hash_contents();
+}
+
+/* the section names a parent container holding part of its types */
+bool
+CtfMetaData::has_parent() const
+{
+	if (section.size < sizeof(ctf_header_t))
+		return (false);
+
+	return (reinterpret_cast<const ctf_header_t *>(section.data)
+		    ->cth_parname != 0);
+}
+
+/*
+ * the hashes decide, a byte compare only confirms the rare case where the
+ * inputs look identical. Children of a parent container are never equal
+ * here, their parents may differ.
+ */
+bool
+CtfMetaData::same_contents(const CtfMetaData &rhs) const
+{
+	if (has_parent() || rhs.has_parent())
+		return (false);
+
+	if (section_hash != rhs.section_hash ||
+	    symbol_hash != rhs.symbol_hash || section.size != rhs.section.size)
+		return (false);
+
+	return (memcmp(section.data, rhs.section.data, section.size) == 0);
+}
+
+/* bytes of CTF held in memory once the section is inflated */
+size_t
+CtfMetaData::resident_size() const
+{
+	const ctf_header_t *header;
+
+	if (section.size < sizeof(ctf_header_t))
+		return (section.size);
+
+	header = reinterpret_cast<const ctf_header_t *>(section.data);
+	if (header->cth_magic == CTF_SWAPPED_MAGIC)
+		return (std::max<size_t>(section.size,
+		    sizeof(ctf_header_t) + bswap32(header->cth_stroff) +
+			bswap32(header->cth_strlen)));
+	return (std::max<size_t>(section.size,
+	    sizeof(ctf_header_t) + header->cth_stroff + header->cth_strlen));
+}
+
+/*
+ * the ELF handle, the descriptor, the mappings, the archive member and the
+ * inflated section belong to the new object. None of them moves in memory,
+ * so the Buffers copied from rhs stay valid.
+ */
+CtfMetaData::CtfMetaData(CtfMetaData &&rhs)
+    : data_fd(rhs.data_fd)
+    , filename(std::move(rhs.filename))
+    , elf(rhs.elf)
+    , index_map(rhs.index_map)
+    , index_size(rhs.index_size)
+    , raw_map(rhs.raw_map)
+    , raw_size(rhs.raw_size)
+    , inflated(std::move(rhs.inflated))
+    , archived(std::move(rhs.archived))
+    , section(rhs.section)
+    , ctfdata(rhs.ctfdata)
+    , symdata(rhs.symdata)
+    , strdata(rhs.strdata)
+    , pointer_size(rhs.pointer_size)
+    , section_hash(rhs.section_hash)
+    , symbol_hash(rhs.symbol_hash)
+    , index(rhs.index)
+{
+	rhs.data_fd = -1;
+	rhs.elf = nullptr;
+	rhs.index_map = nullptr;
+	rhs.raw_map = nullptr;
+	rhs.index = nullptr;
+	rhs.section = rhs.ctfdata = rhs.symdata = rhs.strdata = Buffer();
+}
+
+/* room for the inflated section, ctfdata is pointed at it by the caller */
+std::byte *
+CtfMetaData::inflate_buffer(size_t size)
+{
+	inflated.resize(size);
+	return (inflated.data());
+}
+
+/* ctfdata in memory of this object, copied there unless it was inflated */
+std::byte *
+CtfMetaData::writable_ctfdata()
+{
+	if (inflated.empty() || ctfdata.data != inflated.data()) {
+		inflated.assign(ctfdata.data, ctfdata.data + ctfdata.size);
+		ctfdata = Buffer(inflated.data(), inflated.size());
+	}
+
+	return (inflated.data());
 }
 
 bool
 CtfMetaData::is_available()
 {
-	return (this->data_fd != -1);
+	return (this->data_fd != -1 || !this->archived.empty());
 }
 
 CtfMetaData::~CtfMetaData()
 {
 	if (this->elf)
 		elf_end(this->elf);
+	if (this->index_map != nullptr)
+		munmap(this->index_map, this->index_size);
+	if (this->raw_map != nullptr)
+		munmap(this->raw_map, this->raw_size);
 	if (this->data_fd != -1)
 		close(this->data_fd);
 }
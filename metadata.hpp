@@ -2,27 +2,63 @@
 
 #include <libelf.h>
 
+#include "index.hpp"
+#include "memacct.hpp"
 #include "utility.hpp"
+#include <cstdint>
 #include <string>
 #include <string_view>
 
+/*
+ * owns everything the Buffers of a file point into: the descriptor, the
+ * ELF handle, the mapping of a raw section or of the sidecar, the member
+ * read from an archive or from memory and the inflated section. It can be
+ * moved, never copied. A file named archive:member is that member of a tar
+ * archive.
+ */
 struct CtfMetaData {
     private:
-	int data_fd;
+	int data_fd = -1;
 	std::string filename;
-	Elf *elf;
+	Elf *elf = nullptr;
+	void *index_map = nullptr;
+	size_t index_size = 0;
+	void *raw_map = nullptr; /* a bare CTF section */
+	size_t raw_size = 0;
+	AcctVector<std::byte, M_INFLATE> inflated; /* section after zlib */
+	AcctVector<std::byte, M_INFLATE> archived; /* member, or from memory */
 
-	bool from_elf_file();
+	bool from_index_file();
+	bool from_file();
+	bool from_elf();
+	bool from_archive(const std::string &archive, const std::string &member);
 	bool from_raw_file();
+	void hash_contents();
 
     public:
+	Buffer section{}; /* the CTF section as stored in the file */
 	Buffer ctfdata{};
 	Buffer symdata{};
 	Buffer strdata{};
+	size_t pointer_size = sizeof(void *); /* from the ELF class */
+	uint64_t section_hash = 0; /* hash of the section as stored */
+	uint64_t symbol_hash = 0;  /* hash of the data and function symbols */
+	const CtfIndexHeader *index = nullptr; /* the sidecar, if fresh */
 
 	CtfMetaData(const std::string &filename);
+	CtfMetaData(const std::string &filename, const std::byte *data,
+	    size_t size);
+	CtfMetaData(CtfMetaData &&rhs);
+	CtfMetaData(const CtfMetaData &) = delete;
+	CtfMetaData &operator=(const CtfMetaData &) = delete;
+	CtfMetaData &operator=(CtfMetaData &&) = delete;
 	~CtfMetaData();
 
-	std::string_view file_name() { return this->filename; }
+	std::string_view file_name() const { return this->filename; }
 	bool is_available();
+	bool has_parent() const;
+	bool same_contents(const CtfMetaData &rhs) const;
+	std::byte *inflate_buffer(size_t size);
+	std::byte *writable_ctfdata();
+	size_t resident_size() const;
 };
@@ -0,0 +1,99 @@
+#include "myers.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+uint32_t
+StringInterner::intern(std::string_view str)
+{
+	return (ids.emplace(str, ids.size()).first->second);
+}
+
+std::vector<MyersEdit>
+myers_diff(const std::vector<uint32_t> &lhs, const std::vector<uint32_t> &rhs)
+{
+	std::vector<MyersEdit> res;
+	size_t n = lhs.size(), m = rhs.size();
+	size_t pre = 0, suf = 0;
+
+	while (pre < n && pre < m && lhs[pre] == rhs[pre])
+		++pre;
+	while (suf < n - pre && suf < m - pre &&
+	    lhs[n - 1 - suf] == rhs[m - 1 - suf])
+		++suf;
+
+	const uint32_t *a = lhs.data() + pre, *b = rhs.data() + pre;
+	long N = n - pre - suf, M = m - pre - suf;
+	long max = N + M, d, k, x, y;
+
+	/*
+	 * v[k] is the furthest x reached on diagonal k. trace[d] keeps the
+	 * slice of v for diagonals -(d - 1) .. (d - 1) before round d, which
+	 * is all the backtracking needs, so the memory is O(D^2).
+	 */
+	std::vector<long> v(2 * max + 3, 0);
+	std::vector<std::vector<long>> trace;
+	const long off = max + 1;
+
+	for (d = 0; d <= max; ++d) {
+		if (d == 0)
+			trace.emplace_back();
+		else
+			trace.emplace_back(v.begin() + off - (d - 1),
+			    v.begin() + off + d);
+		for (k = -d; k <= d; k += 2) {
+			if (k == -d || (k != d && v[off + k - 1] < v[off + k + 1]))
+				x = v[off + k + 1];
+			else
+				x = v[off + k - 1] + 1;
+			y = x - k;
+			while (x < N && y < M && a[x] == b[y])
+				++x, ++y;
+			v[off + k] = x;
+			if (x >= N && y >= M)
+				goto found;
+		}
+	}
+
+found:
+	for (size_t i = 0; i < suf; ++i)
+		res.push_back({ M_KEEP, n - 1 - i, m - 1 - i });
+
+	x = N, y = M;
+	for (; d > 0; --d) {
+		const std::vector<long> &prev = trace[d];
+		long prev_k, prev_x, prev_y;
+
+		k = x - y;
+		auto at = [&](long kk) { return (prev[kk + d - 1]); };
+		if (k == -d || (k != d && at(k - 1) < at(k + 1)))
+			prev_k = k + 1;
+		else
+			prev_k = k - 1;
+		prev_x = at(prev_k);
+		prev_y = prev_x - prev_k;
+
+		while (x > prev_x && y > prev_y) {
+			--x, --y;
+			res.push_back({ M_KEEP, pre + x, pre + y });
+		}
+		if (x == prev_x)
+			res.push_back({ M_INSERT, pre + x, pre + y - 1 });
+		else
+			res.push_back({ M_DELETE, pre + x - 1, pre + y });
+		x = prev_x, y = prev_y;
+	}
+
+	while (x > 0 && y > 0) {
+		--x, --y;
+		res.push_back({ M_KEEP, pre + x, pre + y });
+	}
+
+	for (size_t i = pre; i > 0; --i)
+		res.push_back({ M_KEEP, i - 1, i - 1 });
+
+	std::reverse(res.begin(), res.end());
+	return (res);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+enum MyersOp {
+	M_KEEP,
+	M_INSERT,
+	M_DELETE,
+};
+
+struct MyersEdit {
+	MyersOp op;
+	size_t l_idx; /* index in lhs, meaningless for M_INSERT */
+	size_t r_idx; /* index in rhs, meaningless for M_DELETE */
+};
+
+/*
+ * intern the strings of two sequences into small integers, so that
+ * the diff compares ids instead of strings
+ */
+struct StringInterner {
+    private:
+	std::unordered_map<std::string_view, uint32_t> ids;
+
+    public:
+	uint32_t intern(std::string_view str);
+};
+
+/*
+ * Myers' O(ND) shortest edit script between lhs and rhs. The edits are
+ * returned in order; common prefix and suffix are trimmed beforehand so
+ * that long sequences with a few changes stay close to linear.
+ */
+std::vector<MyersEdit> myers_diff(const std::vector<uint32_t> &lhs,
+    const std::vector<uint32_t> &rhs);
@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+ * the static probes of ctfdiff_provider.d. The header is generated by
+ * dtrace -h, a build without it gets probes that compile to nothing.
+ */
+#if __has_include("ctfdiff_provider.h")
+#include "ctfdiff_provider.h"
+#else
+#define CTFDIFF_LOAD_START(file)
+#define CTFDIFF_LOAD_START_ENABLED() (0)
+#define CTFDIFF_LOAD_DONE(file, size)
+#define CTFDIFF_LOAD_DONE_ENABLED() (0)
+#define CTFDIFF_INFLATE_START(file, size)
+#define CTFDIFF_INFLATE_START_ENABLED() (0)
+#define CTFDIFF_INFLATE_DONE(file, size)
+#define CTFDIFF_INFLATE_DONE_ENABLED() (0)
+#define CTFDIFF_PARSE_TYPE(file, id, kind)
+#define CTFDIFF_PARSE_TYPE_ENABLED() (0)
+#define CTFDIFF_COMPARE_ENTRY(lhs, rhs)
+#define CTFDIFF_COMPARE_ENTRY_ENABLED() (0)
+#define CTFDIFF_COMPARE_RETURN(lhs, rhs, result)
+#define CTFDIFF_COMPARE_RETURN_ENABLED() (0)
+#define CTFDIFF_CACHE_HIT(lhs, rhs, result)
+#define CTFDIFF_CACHE_HIT_ENABLED() (0)
+#define CTFDIFF_CACHE_MISS(lhs, rhs)
+#define CTFDIFF_CACHE_MISS_ENABLED() (0)
+#endif
+
+#include <string_view>
+
+/* probes take char *, the strings passed are never written */
+static inline char *
+probe_str(std::string_view s)
+{
+	return (const_cast<char *>(s.data()));
+}
@@ -0,0 +1,112 @@
+#include <sys/resource.h>
+
+#include "sys/ctf.h"
+
+#include "memacct.hpp"
+#include "stats.hpp"
+#include "utility.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iterator>
+#include <mutex>
+#include <ostream>
+
+thread_local CtfStats ctf_stats;
+
+static std::mutex run_lock;
+static CtfStats run_stats; /* folded by the threads so far */
+
+CtfPhaseTimer::CtfPhaseTimer(CtfPhase phase)
+    : phase(phase)
+{
+	if ((flags & F_STATS) != 0)
+		start = std::chrono::steady_clock::now();
+}
+
+CtfPhaseTimer::~CtfPhaseTimer()
+{
+	if ((flags & F_STATS) == 0)
+		return;
+
+	ctf_stats.phase_ms[phase] += std::chrono::duration<double, std::milli>(
+	    std::chrono::steady_clock::now() - start)
+					 .count();
+}
+
+CtfStats &
+CtfStats::operator+=(const CtfStats &rhs)
+{
+	for (int i = 0; i < P_MAX; ++i)
+		phase_ms[i] += rhs.phase_ms[i];
+	for (size_t i = 0; i < std::size(kinds); ++i)
+		kinds[i] += rhs.kinds[i];
+
+	symbols_matched += rhs.symbols_matched;
+	symbols_changed += rhs.symbols_changed;
+	symbols_added += rhs.symbols_added;
+	symbols_removed += rhs.symbols_removed;
+	compare_nodes += rhs.compare_nodes;
+	cache_hits += rhs.cache_hits;
+	cache_misses += rhs.cache_misses;
+	cache_drops += rhs.cache_drops;
+	prewarm_pairs += rhs.prewarm_pairs;
+	prewarm_nodes += rhs.prewarm_nodes;
+	max_depth = std::max(max_depth, rhs.max_depth);
+
+	return (*this);
+}
+
+void
+ctf_stats_fold()
+{
+	std::lock_guard<std::mutex> guard(run_lock);
+
+	run_stats += ctf_stats;
+	ctf_stats = CtfStats();
+}
+
+CtfStats
+ctf_stats_total()
+{
+	ctf_stats_fold();
+
+	std::lock_guard<std::mutex> guard(run_lock);
+	return (run_stats);
+}
+
+void
+CtfStats::print(std::ostream &out) const
+{
+	static const char *phase_names[P_MAX] = { "load", "inflate", "types",
+		"symbols", "sort", "compare", "output" };
+	static const char *kind_names[] = { "unknown", "integer", "float",
+		"pointer", "array", "function", "struct", "union", "enum",
+		"forward", "typedef", "volatile", "const", "restrict" };
+	struct rusage ru;
+
+	out << "--- stats\n" << std::fixed << std::setprecision(3);
+
+	for (int i = 0; i < P_MAX; ++i)
+		out << "time." << phase_names[i] << ": " << phase_ms[i]
+		    << " ms\n";
+
+	for (int i = 0; i <= CTF_K_RESTRICT; ++i)
+		out << "types." << kind_names[i] << ": " << kinds[i] << '\n';
+
+	out << "symbols.matched: " << symbols_matched << '\n'
+	    << "symbols.changed: " << symbols_changed << '\n'
+	    << "symbols.added: " << symbols_added << '\n'
+	    << "symbols.removed: " << symbols_removed << '\n'
+	    << "compare.nodes: " << compare_nodes << '\n'
+	    << "compare.cache_hits: " << cache_hits << '\n'
+	    << "compare.cache_misses: " << cache_misses << '\n'
+	    << "compare.cache_drops: " << cache_drops << '\n'
+	    << "compare.prewarm_pairs: " << prewarm_pairs << '\n'
+	    << "compare.prewarm_nodes: " << prewarm_nodes << '\n'
+	    << "compare.max_depth: " << max_depth << '\n';
+	mem_print(out);
+
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		out << "peak_rss_kb: " << ru.ru_maxrss << '\n';
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+/* phases of a diff timed by -stats */
+enum CtfPhase {
+	P_LOAD,	   /* open the ELF file and find the sections */
+	P_INFLATE, /* zlib */
+	P_TYPES,   /* walk and decode the type region */
+	P_SYMBOLS, /* match the data and function sections to the symbols */
+	P_SORT,	   /* sort the symbols by name */
+	P_COMPARE, /* compare and format the report */
+	P_OUTPUT,  /* write the report */
+	P_MAX,
+};
+
+/*
+ * what a diff did, printed at the end of the run by -stats. Each thread
+ * counts its own work, the counters are cheap enough to be always on.
+ * The threads of a pool fold theirs into those of the run after each job,
+ * so their phase times add up to more than the wall time.
+ */
+struct CtfStats {
+	double phase_ms[P_MAX] = {};
+	uint64_t kinds[16] = {}; /* decoded types by CTF_K_* */
+	uint64_t symbols_matched = 0;
+	uint64_t symbols_changed = 0;
+	uint64_t symbols_added = 0;
+	uint64_t symbols_removed = 0;
+	uint64_t compare_nodes = 0; /* pairs of types visited by the compare */
+	uint64_t cache_hits = 0;
+	uint64_t cache_misses = 0;
+	uint64_t cache_drops = 0; /* for -max-memory */
+	uint64_t prewarm_pairs = 0; /* compared ahead of the symbols */
+	uint64_t prewarm_nodes = 0; /* of compare_nodes, visited by those */
+	uint32_t depth = 0; /* of the compare in progress */
+	uint32_t max_depth = 0;
+
+	CtfStats &operator+=(const CtfStats &rhs);
+	void print(std::ostream &out) const;
+};
+
+extern thread_local CtfStats ctf_stats;
+
+void ctf_stats_fold(); /* adds ctf_stats to the run and clears it */
+CtfStats ctf_stats_total(); /* of the run, ctf_stats folded in */
+
+/* adds its lifetime to a phase of ctf_stats when -stats is given */
+struct CtfPhaseTimer {
+    private:
+	CtfPhase phase;
+	std::chrono::steady_clock::time_point start;
+
+    public:
+	CtfPhaseTimer(CtfPhase phase);
+	~CtfPhaseTimer();
+};
@@ -1,7 +1,84 @@
+#include <fnmatch.h>
+
 #include "ctftype.hpp"
 #include "utility.hpp"
 #include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
 #include <typeinfo>
 
 int flags = 0;
 std::vector<const std::type_info *> ignore_ids = { &typeid(CtfTypeTypeDef) };
+std::vector<std::string> symbol_globs;
+
+bool
+symbol_selected(std::string_view name)
+{
+	std::string str(name);
+
+	if (symbol_globs.empty())
+		return (true);
+
+	for (const auto &glob : symbol_globs)
+		if (fnmatch(glob.c_str(), str.c_str(), 0) == 0)
+			return (true);
+
+	return (false);
+}
+
+bool
+add_symbol_list(const std::string &path)
+{
+	std::ifstream in(path);
+	std::string line;
+
+	if (!in) {
+		std::cout << "Cannot read symbol list " << path << '\n';
+		return (false);
+	}
+
+	while (std::getline(in, line)) {
+		size_t first = line.find_first_not_of(" \t");
+		size_t last = line.find_last_not_of(" \t\r");
+
+		if (first == std::string::npos || line[first] == '#')
+			continue;
+		symbol_globs.push_back(line.substr(first, last - first + 1));
+	}
+
+	return (true);
+}
+
+std::optional<size_t>
+parse_size(const char *str)
+{
+	char *end;
+	unsigned long long size = strtoull(str, &end, 10);
+
+	if (end == str)
+		return (std::nullopt);
+
+	switch (*end) {
+	case 'G':
+	case 'g':
+		size <<= 10;
+		/* FALLTHROUGH */
+	case 'M':
+	case 'm':
+		size <<= 10;
+		/* FALLTHROUGH */
+	case 'K':
+	case 'k':
+		size <<= 10;
+		++end;
+		break;
+	}
+
+	if (*end != '\0')
+		return (std::nullopt);
+
+	return (size);
+}
@@ -3,32 +3,50 @@
 #include <libelf.h>
 
 #include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
 #include <typeinfo>
 #include <vector>
 
 extern int flags;
 extern std::vector<const std::type_info *> ignore_ids;
+extern std::vector<std::string> symbol_globs; /* -symbol, -symbols-from */
 
 enum CtfFlag {
 	F_IGNORE_CONST = 1,
+	F_DIFF_TYPES = 2,
+	F_LAYOUT = 4,
+	F_STATS = 8,
 };
 
+/* whether a data or function symbol is selected, all are without globs */
+bool symbol_selected(std::string_view name);
+
+/* add the globs of a file, one per line, '#' starts a comment line */
+bool add_symbol_list(const std::string &path);
+
+/* parse a byte count with an optional K, M or G suffix */
+std::optional<size_t> parse_size(const char *str);
+
+/*
+ * a view of bytes owned by a CtfMetaData: a section of its ELF handle, its
+ * mapping of a raw section or of a sidecar, or its inflated copy. It is
+ * valid as long as the owner is, a move of the owner included.
+ */
 struct Buffer {
-	std::byte *data;
-	size_t size;
-	size_t entries;
-	Elf_Data *elfdata;
+	const std::byte *data = nullptr;
+	size_t size = 0;
+	size_t entries = 0;
+	Elf_Data *elfdata = nullptr;
 
-	Buffer(std::byte *data, size_t size)
+	Buffer(const std::byte *data, size_t size)
 	    : data(data)
-	    , size(size)
-	    , entries(0)
-	    , elfdata(nullptr) {};
-	Buffer(std::byte *data, size_t size, size_t entries)
+	    , size(size) {};
+	Buffer(const std::byte *data, size_t size, size_t entries)
 	    : data(data)
 	    , size(size)
-	    , entries(entries)
-	    , elfdata(nullptr) {};
+	    , entries(entries) {};
 
 	Buffer() = default;
 };
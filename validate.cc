@@ -0,0 +1,110 @@
+#include <string.h>
+
+#include "validate.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+
+bool
+ctf_check_header(const ctf_header_t *header, const std::byte *data,
+    size_t size, std::string &error)
+{
+	static const char *names[] = { "cth_lbloff", "cth_objtoff",
+		"cth_funcoff", "cth_typeoff", "cth_stroff" };
+	uint32_t bounds[] = { header->cth_lbloff, header->cth_objtoff,
+		header->cth_funcoff, header->cth_typeoff, header->cth_stroff };
+	uint64_t strend = (uint64_t)header->cth_stroff + header->cth_strlen;
+
+	for (size_t i = 0; i + 1 < std::size(bounds); ++i) {
+		if (bounds[i] > bounds[i + 1]) {
+			error = std::string(names[i]) + " " +
+			    std::to_string(bounds[i]) + " is past " +
+			    names[i + 1] + " " + std::to_string(bounds[i + 1]);
+			return (false);
+		}
+	}
+
+	if (header->cth_typeoff & 3) {
+		error = "cth_typeoff " + std::to_string(header->cth_typeoff) +
+		    " is not aligned properly";
+		return (false);
+	}
+
+	if (strend > size) {
+		error = "the string table ends at " + std::to_string(strend) +
+		    ", past the " + std::to_string(size) +
+		    " bytes of the section: it is truncated or "
+		    "cth_strlen is corrupt";
+		return (false);
+	}
+
+	/* then every offset into the table names a terminated string */
+	if (header->cth_strlen == 0 || data[strend - 1] != std::byte { 0 }) {
+		error = "the string table is not terminated";
+		return (false);
+	}
+
+	if (!ctf_name_valid(header, header->cth_parname)) {
+		error = "cth_parname " +
+		    std::to_string(CTF_NAME_OFFSET(header->cth_parname)) +
+		    " is beyond the string table";
+		return (false);
+	}
+
+	return (true);
+}
+
+template <typename V>
+static bool
+check_section(const ctf_header_t *header, const std::byte *data,
+    std::string &error)
+{
+	uint32_t child_base = header->cth_parname != 0 ? 1u << V::parent_shift :
+							   0;
+	uint32_t last_id = 0;
+
+	return (ctf_check_types<V>(header, data, child_base, last_id, error,
+		    [](uint32_t, uint32_t, const CtfRecord<V> &) {}) &&
+	    ctf_check_symbols<V>(header, data, child_base, last_id, error));
+}
+
+/*
+ * the checks of a section parsed by ctfdiff on their own, with no file
+ * around them. This is also the entry point of fuzz/ctf_check_fuzz.cc.
+ */
+bool
+ctf_check_section(const std::byte *section, size_t size, std::string &error)
+{
+	ctf_header_t header;
+
+	if (size < sizeof(header)) {
+		error = "the section is smaller than a CTF header";
+		return (false);
+	}
+
+	memcpy(&header, section, sizeof(header));
+	if (header.cth_magic != CTF_MAGIC) {
+		error = "the section does not start with the CTF magic";
+		return (false);
+	}
+	if (header.cth_version != CTF_VERSION_2 &&
+	    header.cth_version != CTF_VERSION_3) {
+		error = "CTF version " + std::to_string(header.cth_version) +
+		    " is not available";
+		return (false);
+	}
+	if (header.cth_flags & CTF_F_COMPRESS) {
+		error = "the section is compressed";
+		return (false);
+	}
+
+	section += sizeof(header);
+	size -= sizeof(header);
+	if (!ctf_check_header(&header, section, size, error))
+		return (false);
+
+	if (header.cth_version == CTF_VERSION_2)
+		return (check_section<CtfV2>(&header, section, error));
+	return (check_section<CtfV3>(&header, section, error));
+}
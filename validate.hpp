@@ -0,0 +1,298 @@
+#pragma once
+
+#include <string.h>
+
+#include "ctf_headers.h"
+#include "sys/ctf.h"
+
+#include "ctftype.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * Checks of an inflated CTF section, done while it is indexed. Once they
+ * pass, every record fits in its region, every type it refers to is 0, a
+ * type of the parent or one of its own, every chain of typedefs and
+ * qualifiers ends and every name is a terminated string of the string
+ * table, so the decode loops read the section without checking it again.
+ * On failure, error describes the first problem found.
+ */
+
+/* the regions and the string table, data and size exclude the header */
+bool ctf_check_header(const ctf_header_t *header, const std::byte *data,
+    size_t size, std::string &error);
+
+/* a whole section, header included, as stored in a sidecar */
+bool ctf_check_section(const std::byte *section, size_t size,
+    std::string &error);
+
+/* ids below child_base belong to the parent, which is checked on its own */
+inline bool
+ctf_ref_valid(uint32_t ref, uint32_t child_base, uint32_t last_id)
+{
+	return (ref == 0 || ref < child_base ||
+	    (ref > child_base && ref <= last_id));
+}
+
+inline bool
+ctf_name_valid(const ctf_header_t *header, uint_t name)
+{
+	return (CTF_NAME_STID(name) != CTF_STRTAB_0 ||
+	    CTF_NAME_OFFSET(name) < header->cth_strlen);
+}
+
+/*
+ * walk the type section, calling visit(id, offset, record) for each type
+ * that is sound. References ahead of the walk are checked once the last
+ * id is known, which is stored in last_id.
+ */
+template <typename V, typename Visit>
+bool
+ctf_check_types(const ctf_header_t *header, const std::byte *data,
+    uint32_t child_base, uint32_t &last_id, std::string &error, Visit &&visit)
+{
+	const std::byte *start = data + header->cth_typeoff;
+	const std::byte *end = data + header->cth_stroff;
+	const std::byte *iter = start;
+	uint32_t limit = child_base != 0 ? V::max_type : V::max_ptype;
+	uint32_t id = child_base, max_ref = 0, max_from = 0;
+	std::vector<uint32_t> alias; /* what a typedef or qualifier names */
+
+	/* what is a part of the record, numbered by n unless it is -1 */
+	auto fail = [&](const char *what, long n, const std::string &why) {
+		error = "type " + std::to_string(id) + " at offset " +
+		    std::to_string(iter - start) + ": " + what +
+		    (n >= 0 ? " " + std::to_string(n) : "") + why;
+		return (false);
+	};
+	auto ref = [&](uint32_t type, const char *what, long n = -1) {
+		if (child_base != 0 && type == child_base)
+			return (fail(what, n,
+			    " refers to type " + std::to_string(type) +
+				", below the first type"));
+		if (type > max_ref && type >= child_base) {
+			max_ref = type;
+			max_from = id;
+		}
+		return (true);
+	};
+	auto name = [&](uint_t str, const char *what, long n = -1) {
+		if (ctf_name_valid(header, str))
+			return (true);
+		return (fail(what, n,
+		    " name " + std::to_string(CTF_NAME_OFFSET(str)) +
+			" is beyond the string table of " +
+			std::to_string(header->cth_strlen) + " bytes"));
+	};
+
+	while (iter < end) {
+		size_t left = end - iter;
+		typename V::stype_t st;
+
+		if (++id > limit)
+			return (fail("record", -1,
+			    " is past the " + std::to_string(limit) +
+				" types of the CTF version"));
+
+		if (left < sizeof(st))
+			return (fail("record", -1, " is truncated"));
+		memcpy(&st, iter, sizeof(st));
+		if (st.ctt_size == V::lsize_sent &&
+		    left < sizeof(typename V::type_t))
+			return (fail("record", -1, " is truncated"));
+
+		CtfRecord<V> rec(iter);
+		const std::byte *var = iter + rec.increment();
+
+		if (rec.kind() > CTF_K_RESTRICT)
+			return (fail("kind", rec.kind(), " is unexpected"));
+		if (left - rec.increment() < rec.vlen_bytes())
+			return (fail("record", -1,
+			    " with " + std::to_string(rec.vlen()) +
+				" entries does not fit in the type section"));
+		if (!name(rec.name(), "type"))
+			return (false);
+
+		switch (rec.kind()) {
+		case CTF_K_POINTER:
+		case CTF_K_TYPEDEF:
+		case CTF_K_VOLATILE:
+		case CTF_K_CONST:
+		case CTF_K_RESTRICT:
+			if (!ref(rec.type(), "type"))
+				return (false);
+			break;
+
+		case CTF_K_ARRAY: {
+			ArrayEntry arr = rec.array(var);
+
+			if (!ref(arr.contents, "array contents") ||
+			    !ref(arr.index, "array index"))
+				return (false);
+			break;
+		}
+
+		case CTF_K_FUNCTION:
+			if (!ref(rec.type(), "return type"))
+				return (false);
+			for (ulong_t i = 0; i < rec.vlen(); ++i) {
+				uint32_t arg = 0;
+
+				memcpy(&arg, var + i * V::id_width, V::id_width);
+				if (!ref(arg, "argument", i))
+					return (false);
+			}
+			break;
+
+		case CTF_K_STRUCT:
+		case CTF_K_UNION:
+			for (ulong_t i = 0; i < rec.vlen(); ++i) {
+				uint_t member_name, member_type;
+
+				if (rec.size() >= V::lstruct_thresh) {
+					typename V::lmember_t m;
+
+					memcpy(&m, var + i * sizeof(m), sizeof(m));
+					member_name = m.ctlm_name;
+					member_type = m.ctlm_type;
+				} else {
+					typename V::member_t m;
+
+					memcpy(&m, var + i * sizeof(m), sizeof(m));
+					member_name = m.ctm_name;
+					member_type = m.ctm_type;
+				}
+				if (!name(member_name, "member", i) ||
+				    !ref(member_type, "member", i))
+					return (false);
+			}
+			break;
+
+		case CTF_K_ENUM:
+			for (ulong_t i = 0; i < rec.vlen(); ++i) {
+				ctf_enum_t e;
+
+				memcpy(&e, var + i * sizeof(e), sizeof(e));
+				if (!name(e.cte_name, "enumerator", i))
+					return (false);
+			}
+			break;
+		}
+
+		alias.push_back(rec.kind() >= CTF_K_TYPEDEF ? rec.type() : 0);
+		visit(id, static_cast<uint32_t>(iter - start), rec);
+		iter += rec.increment() + rec.vlen_bytes();
+	}
+
+	last_id = id;
+	if (max_ref > last_id) {
+		error = "type " + std::to_string(max_from) + " refers to type " +
+		    std::to_string(max_ref) + ", the last type is " +
+		    std::to_string(last_id);
+		return (false);
+	}
+
+	/*
+	 * typedefs and qualifiers are looked through without a bound, so each
+	 * chain of them must end. Marks are 1 on the chain walked, 2 once known
+	 * to end.
+	 */
+	std::vector<uint8_t> seen(alias.size());
+
+	for (size_t i = 0; i < alias.size(); ++i) {
+		size_t j = i;
+
+		while (seen[j] == 0) {
+			seen[j] = 1;
+			if (alias[j] <= child_base)
+				break;
+			j = alias[j] - child_base - 1;
+		}
+		if (seen[j] == 1 && alias[j] > child_base) {
+			error = "type " + std::to_string(child_base + 1 + j) +
+			    " is in a cycle of typedefs and qualifiers";
+			return (false);
+		}
+		for (j = i; seen[j] == 1; j = alias[j] - child_base - 1) {
+			seen[j] = 2;
+			if (alias[j] <= child_base)
+				break;
+		}
+	}
+
+	return (true);
+}
+
+/* the object and function sections, once the types are checked */
+template <typename V>
+bool
+ctf_check_symbols(const ctf_header_t *header, const std::byte *data,
+    uint32_t child_base, uint32_t last_id, std::string &error)
+{
+	const std::byte *iter = data + header->cth_objtoff;
+	const std::byte *end = data + header->cth_funcoff;
+	uint32_t sym, type = 0;
+
+	if ((end - iter) % V::id_width != 0) {
+		error = "object section of " + std::to_string(end - iter) +
+		    " bytes is not made of type ids";
+		return (false);
+	}
+
+	for (sym = 0; iter < end; ++sym, iter += V::id_width) {
+		memcpy(&type, iter, V::id_width);
+		if (!ctf_ref_valid(type, child_base, last_id)) {
+			error = "object " + std::to_string(sym) +
+			    " refers to type " + std::to_string(type) +
+			    ", the last type is " + std::to_string(last_id);
+			return (false);
+		}
+	}
+
+	end = data + header->cth_typeoff;
+	for (sym = 0; iter < end; ++sym) {
+		uint_t info = 0;
+
+		if ((size_t)(end - iter) < V::id_width) {
+			error = "function " + std::to_string(sym) +
+			    " is truncated";
+			return (false);
+		}
+		memcpy(&info, iter, V::id_width);
+		iter += V::id_width;
+
+		ulong_t n = V::vlen(info);
+		int kind = V::kind(info);
+
+		if (kind == CTF_K_UNKNOWN && n == 0)
+			continue; /* padding */
+
+		if (kind != CTF_K_FUNCTION) {
+			error = "function " + std::to_string(sym) +
+			    " has kind " + std::to_string(kind);
+			return (false);
+		}
+
+		if ((size_t)(end - iter) / V::id_width < n + 1) {
+			error = "function " + std::to_string(sym) + " with " +
+			    std::to_string(n) +
+			    " arguments does not fit in the function section";
+			return (false);
+		}
+
+		for (ulong_t i = 0; i <= n; ++i, iter += V::id_width) {
+			memcpy(&type, iter, V::id_width);
+			if (!ctf_ref_valid(type, child_base, last_id)) {
+				error = "function " + std::to_string(sym) +
+				    " refers to type " + std::to_string(type) +
+				    ", the last type is " +
+				    std::to_string(last_id);
+				return (false);
+			}
+		}
+	}
+
+	return (true);
+}
@@ -0,0 +1,234 @@
+#include <sys/inotify.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "ctfdata.hpp"
+#include "driver.hpp"
+#include "fingerprint.hpp"
+#include "metadata.hpp"
+#include "myers.hpp"
+#include "stats.hpp"
+#include "utility.hpp"
+#include <cerrno>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/* a rebuild writes the file in several steps, wait for them to settle */
+#define WATCH_SETTLE_MS 200
+
+/*
+ * what is kept between two rebuilds: the previous candidate, whose
+ * fingerprints are taken over when its types did not change, and the
+ * report printed for it
+ */
+struct WatchState {
+	ShrCtfData base;
+	CtfSymbolPrints base_prints;
+	ShrCtfData prev;
+	std::optional<CtfSymbolPrints> prev_prints;
+	std::vector<std::string> report;
+};
+
+/*
+ * whether the symbols of both have types that compare equal. Unknown types
+ * never match, and a cycle too large for the fingerprints makes us say no.
+ */
+static bool
+same_prints(const CtfSymbolPrints &lhs, const CtfSymbolPrints &rhs)
+{
+	auto same_list = [](const std::vector<CtfSymbolPrints::Entry> &l,
+			     const std::vector<CtfSymbolPrints::Entry> &r) {
+		if (l.size() != r.size())
+			return (false);
+
+		for (size_t i = 0; i < l.size(); ++i)
+			if (l[i].name != r[i].name || l[i].id != r[i].id ||
+			    l[i].deep != r[i].deep)
+				return (false);
+
+		return (true);
+	};
+
+	return (lhs.exact && rhs.exact &&
+	    same_list(lhs.functions, rhs.functions) &&
+	    same_list(lhs.variables, rhs.variables));
+}
+
+static std::vector<std::string>
+split_lines(const std::string &str)
+{
+	std::vector<std::string> lines;
+	std::istringstream in(str);
+	std::string line;
+
+	while (std::getline(in, line))
+		lines.push_back(line);
+
+	return (lines);
+}
+
+/* print the lines of report missing from and added to the previous one */
+static void
+print_delta(const std::string &candidate, const std::vector<std::string> &lhs,
+    const std::vector<std::string> &rhs)
+{
+	StringInterner interner;
+	std::vector<uint32_t> l_ids, r_ids;
+
+	for (const auto &line : lhs)
+		l_ids.push_back(interner.intern(line));
+	for (const auto &line : rhs)
+		r_ids.push_back(interner.intern(line));
+
+	std::cout << "@@ " << candidate << " @@\n";
+
+	for (const auto &edit : myers_diff(l_ids, r_ids)) {
+		if (edit.op == M_DELETE)
+			std::cout << '-' << lhs[edit.l_idx] << '\n';
+		else if (edit.op == M_INSERT)
+			std::cout << '+' << rhs[edit.r_idx] << '\n';
+	}
+}
+
+/*
+ * parse the candidate again and report what changed. The full compare is
+ * skipped when the fingerprints of the symbols prove the report can not
+ * have changed, or that the candidate matches the baseline.
+ */
+static void
+refresh(WatchState &state, const std::string &candidate)
+{
+	CtfMetaData metadata(candidate);
+
+	if (!metadata.is_available()) {
+		std::cout << "Cannot parse file " << candidate << '\n';
+		return;
+	}
+
+	if (state.prev != nullptr &&
+	    metadata.same_contents(state.prev->meta_data()))
+		return;
+
+	auto info = CtfData::create_ctf_info(std::move(metadata));
+	if (info == nullptr)
+		return;
+
+	if (state.prev != nullptr)
+		info->reuse_fingerprints(*state.prev);
+
+	CtfSymbolPrints prints = CtfSymbolPrints::from_data(*info);
+	bool symbols_only = (flags & (F_DIFF_TYPES | F_LAYOUT)) == 0;
+	std::vector<std::string> report;
+
+	if (symbols_only && state.prev_prints &&
+	    same_prints(*state.prev_prints, prints)) {
+		report = state.report;
+	} else if (!symbols_only || !same_prints(state.base_prints, prints)) {
+		std::ostringstream out;
+
+		diff_report(*state.base, *info, out);
+		report = split_lines(out.str());
+	}
+
+	if (state.prev == nullptr) {
+		for (const auto &line : report)
+			std::cout << line << '\n';
+	} else if (report != state.report) {
+		print_delta(candidate, state.report, report);
+	}
+
+	/* each refresh counts on its own, the baseline goes with the first */
+	if ((flags & F_STATS) != 0) {
+		ctf_stats.print(std::cout);
+		ctf_stats = CtfStats();
+	}
+	std::cout.flush();
+
+	state.prev = std::move(info);
+	state.prev_prints = std::move(prints);
+	state.report = std::move(report);
+}
+
+/*
+ * block until the candidate was written or replaced in its directory,
+ * then until no event came for WATCH_SETTLE_MS
+ */
+static bool
+wait_change(int fd, const std::string &name)
+{
+	alignas(struct inotify_event) char buf[4096];
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	bool changed = false;
+	int timeout = -1;
+
+	for (;;) {
+		int ready = poll(&pfd, 1, timeout);
+
+		if (ready == -1 && errno == EINTR)
+			continue;
+		if (ready == -1)
+			return (false);
+		if (ready == 0)
+			return (true);
+
+		ssize_t len = read(fd, buf, sizeof(buf));
+		if (len <= 0)
+			return (false);
+
+		for (char *p = buf; p < buf + len;) {
+			auto *event = reinterpret_cast<struct inotify_event *>(p);
+
+			if (event->len != 0 && name == event->name)
+				changed = true;
+			p += sizeof(struct inotify_event) + event->len;
+		}
+
+		if (changed)
+			timeout = WATCH_SETTLE_MS;
+	}
+}
+
+int
+watch_diff(const std::string &baseline, const std::string &candidate)
+{
+	std::filesystem::path path(candidate);
+	std::string dir = path.has_parent_path() ? path.parent_path().string() :
+						   ".";
+	WatchState state;
+	CtfMetaData metadata(baseline);
+
+	if (!metadata.is_available()) {
+		std::cout << "Cannot parse file " << baseline << '\n';
+		return (1);
+	}
+
+	if ((state.base = CtfData::create_ctf_info(std::move(metadata))) ==
+	    nullptr)
+		return (1);
+	state.base_prints = CtfSymbolPrints::from_data(*state.base);
+
+	/* the directory is watched, rebuilds often replace the file */
+	int fd = inotify_init1(IN_CLOEXEC);
+
+	if (fd == -1 ||
+	    inotify_add_watch(fd, dir.c_str(),
+		IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) == -1) {
+		std::cout << "Cannot watch " << dir << '\n';
+		if (fd != -1)
+			close(fd);
+		return (1);
+	}
+
+	refresh(state, candidate);
+
+	while (wait_change(fd, path.filename().string()))
+		refresh(state, candidate);
+
+	close(fd);
+	return (1);
+}
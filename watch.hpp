@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+/*
+ * compare candidate against baseline every time candidate is rewritten,
+ * until interrupted. The first report is printed whole, later ones only
+ * as the lines that changed since the report before.
+ */
+int watch_diff(const std::string &baseline, const std::string &candidate);
@@ -0,0 +1,124 @@
+#include "workpool.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+WorkPool::WorkPool(unsigned nthreads)
+{
+	nthreads = std::max(1u, nthreads);
+
+	for (unsigned i = 0; i < nthreads; ++i)
+		queues.push_back(std::make_unique<Queue>());
+	for (unsigned i = 0; i < nthreads; ++i)
+		threads.emplace_back(&WorkPool::run, this, i);
+}
+
+WorkPool::~WorkPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	cv.notify_all();
+
+	for (auto &t : threads)
+		t.join();
+}
+
+void
+WorkPool::submit(std::function<void()> &&task)
+{
+	Queue *q;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		q = queues[next++ % queues.size()].get();
+		++pending;
+		++queued;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(q->lock);
+		q->tasks.push_back(std::move(task));
+	}
+	cv.notify_all();
+}
+
+bool
+WorkPool::pop(size_t self, std::function<void()> &task)
+{
+	size_t n = queues.size();
+
+	for (size_t i = 0; i < n; ++i) {
+		Queue &q = *queues[(self + i) % n];
+		std::lock_guard<std::mutex> guard(q.lock);
+
+		if (q.tasks.empty())
+			continue;
+
+		task = std::move(q.tasks.front());
+		q.tasks.pop_front();
+		return (true);
+	}
+
+	return (false);
+}
+
+void
+WorkPool::run(size_t self)
+{
+	std::function<void()> task;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			cv.wait(guard, [&]() { return (stopping || queued > 0); });
+			if (queued == 0)
+				return;
+			--queued;
+		}
+
+		/* a task is reserved for us, it is in one of the queues */
+		while (!pop(self, task))
+			std::this_thread::yield();
+		task();
+		task = nullptr;
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			--pending;
+		}
+		cv.notify_all();
+	}
+}
+
+void
+WorkPool::wait()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	cv.wait(guard, [&]() { return (pending == 0); });
+}
+
+void
+ResourceBudget::acquire(size_t amount)
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	cv.wait(guard,
+	    [&]() { return (used == 0 || used + amount <= limit); });
+	used += amount;
+}
+
+void
+ResourceBudget::release(size_t amount)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		used -= amount;
+	}
+	cv.notify_all();
+}
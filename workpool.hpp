@@ -0,0 +1,83 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * fixed set of threads, each with its own deque of tasks. A thread runs
+ * its own tasks oldest first and steals the oldest task of another thread
+ * when it runs out, so a few expensive tasks do not leave threads idle.
+ * Tasks thus start roughly in the order they were submitted, which lets
+ * run_ordered in driver.cc print each report soon after it is done.
+ */
+struct WorkPool {
+    private:
+	struct Queue {
+		std::mutex lock;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> threads;
+	std::mutex lock;
+	std::condition_variable cv;
+	size_t pending = 0; /* submitted but not finished */
+	size_t queued = 0;  /* submitted but not started */
+	size_t next = 0;    /* queue receiving the next task */
+	bool stopping = false;
+
+	bool pop(size_t self, std::function<void()> &task);
+	void run(size_t self);
+
+    public:
+	WorkPool(unsigned nthreads);
+	~WorkPool();
+
+	void submit(std::function<void()> &&task);
+	void wait(); /* block until every submitted task is finished */
+};
+
+/*
+ * a shared amount of some resource, e.g. open files or resident bytes.
+ * acquire blocks until the amount fits, a request larger than the limit
+ * is let through when nothing else is held so that it can not deadlock.
+ */
+struct ResourceBudget {
+    private:
+	std::mutex lock;
+	std::condition_variable cv;
+	size_t limit;
+	size_t used = 0;
+
+    public:
+	ResourceBudget(size_t limit)
+	    : limit(limit) {};
+
+	void acquire(size_t amount);
+	void release(size_t amount);
+};
+
+/* an amount of a budget held until the end of the scope */
+struct BudgetHold {
+    private:
+	ResourceBudget &budget;
+	size_t amount;
+
+    public:
+	BudgetHold(ResourceBudget &budget, size_t amount)
+	    : budget(budget)
+	    , amount(amount)
+	{
+		budget.acquire(amount);
+	}
+	~BudgetHold() { budget.release(amount); }
+
+	BudgetHold(const BudgetHold &) = delete;
+	BudgetHold &operator=(const BudgetHold &) = delete;
+};